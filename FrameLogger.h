@@ -78,10 +78,11 @@ struct FrameLogger {
     uint                                         m_frame = 0;
     
     // RAII phase timing wrapper
+    // use LSTRING("name") for the name to avoid interning it every frame
     struct Phase {
         FrameLogger &logger;
-        const char  *name;
-        Phase(FrameLogger& l, const char *n) : logger(l), name(n)
+        lstring      name;
+        Phase(FrameLogger& l, lstring n) : logger(l), name(n)
         {
             logger.beginPhase(name);
         }
@@ -100,14 +101,14 @@ struct FrameLogger {
         m_current.clear();
     }
 
-    void beginPhase(const char *phase)
+    void beginPhase(lstring phase)
     {
         if (m_paused)
             return;
         m_currentPhases.push_back(std::make_pair(phase, OL_GetCurrentTime()));
     }
 
-    void endPhase(const char *phase)
+    void endPhase(lstring phase)
     {
         if (m_paused)
             return;
@@ -121,7 +122,7 @@ struct FrameLogger {
         }
     }
 
-    void addPhase(const char *phase, double length)
+    void addPhase(lstring phase, double length)
     {
         if (m_paused)
             return;
@@ -137,7 +138,7 @@ struct FrameLogger {
             return;
         ASSERT(m_currentPhases.empty());
         ASSERT(m_frameStartTime > 0.0);
-        addPhase("Frame", OL_GetCurrentTime() - m_frameStartTime);
+        addPhase(LSTRING("Frame"), OL_GetCurrentTime() - m_frameStartTime);
         m_frameStartTime = 0.0;
 
         std::lock_guard<std::mutex> l(m_mutex);
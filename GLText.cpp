@@ -61,9 +61,10 @@ const FontStats & FontStats::get(int font, float size)
     return fs;
 }
 
-void GLText::load(const string& str, int font_, float size, float pointSize)
+void GLText::load(str_view_t str, size_t hash, int font_, float size, float pointSize)
 {
-    chars    = str;
+    chars.assign(str.ptr, str.len);
+    charsHash = hash;
     fontSize = size;
     font     = font_;
 
@@ -109,12 +110,11 @@ void GLText::render(const ShaderState* s, float2 pos) const
 
 const GLText* GLText::vget(int font, float size, const char *format, va_list vl)
 {
-    string s = str_vformat(format, vl);
-    return get(font, size, s);
+    return get(font, size, str_vformat_tmp(format, vl));
 }
 
 float2 GLText::Draw(const ShaderState &s_, float2 p, Align align, int font, uint color,
-                    float sizeUnscaled, const std::string &str)
+                    float sizeUnscaled, str_view_t str)
 {
     if (str.empty())
         return float2(0.f);
@@ -150,7 +150,7 @@ float GLText::getCharStart(uint chr) const
 {
     if (chr == 0)
         return 0.f;
-    const GLText *st = get(font, fontSize, chars.substr(0, chr));
+    const GLText *st = get(font, fontSize, str_view_t(chars.c_str(), min((size_t)chr, chars.size())));
     return st->getSize().x;
 }
     
@@ -167,7 +167,7 @@ float GLText::getScaledSize(float sizeUnscaled)
     return sizeUnscaled * ws.y / kTextScaleHeight;
 }
 
-const GLText* GLText::get(int font, float size, const string& s)
+const GLText* GLText::get(int font, float size, str_view_t s)
 {
     float pointSize = OL_GetCurrentBackingScaleFactor();
     //Reportf("scale: %g", pointSize);
@@ -182,9 +182,12 @@ const GLText* GLText::get(int font, float size, const string& s)
         cacheSize = kGLTextCacheSize;
     }
     
+    // hash the text once instead of comparing it against every entry
+    const size_t hash = lstring_hash(s.ptr, s.len);
     for (uint i=0; i<cacheSize; i++)
     {
-        if (cache[i].chars == s && 
+        if (cache[i].charsHash == hash &&
+            str_view_t(cache[i].chars) == s && 
             isZero(cache[i].fontSize - size) && 
             cache[i].texPointSize == pointSize &&
             cache[i].font == font)
@@ -195,7 +198,7 @@ const GLText* GLText::get(int font, float size, const string& s)
 
     // Reportf("RAND %d (gltext)", randrange(1, 101));
     const int i = randrange(0, cacheSize);
-    cache[i].load(s, font, size, pointSize);
+    cache[i].load(s, hash, font, size, pointSize);
     return &cache[i];
 }
 
@@ -204,7 +207,7 @@ float2 GLText::DrawScreen(const ShaderState &s_, float2 p, Align align, uint col
 {
     va_list vl;
     va_start(vl, format);
-    float2 size = Draw(s_, p, align, kDefaultFont, color, sizeUnscaled, str_vformat(format, vl));
+    float2 size = Draw(s_, p, align, kDefaultFont, color, sizeUnscaled, str_vformat_tmp(format, vl));
     va_end(vl);
     return size;
 }
@@ -214,7 +217,7 @@ float2 GLText::Fmt(const ShaderState &s_, float2 p, Align align, uint color,
 {
     va_list vl;
     va_start(vl, fmt);
-    float2 size = Put(s_, p, align, color, sizeUnscaled, str_vformat(fmt, vl));
+    float2 size = Draw(s_, p, align, kDefaultFont, color, getScaledSize(sizeUnscaled), str_vformat_tmp(fmt, vl));
     va_end(vl);
     return size;
 }
@@ -224,7 +227,7 @@ float2 GLText::Fmt(const ShaderState &s_, float2 p, Align align, int font, uint
 {
     va_list vl;
     va_start(vl, fmt);
-    float2 size = Put(s_, p, align, font, color, sizeUnscaled, str_vformat(fmt, vl));
+    float2 size = Draw(s_, p, align, font, color, getScaledSize(sizeUnscaled), str_vformat_tmp(fmt, vl));
     va_end(vl);
     return size;
 }
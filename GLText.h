@@ -57,10 +57,11 @@ class GLText {
     float          texPointSize = 0.f;
 
     string         chars;
+    size_t         charsHash = 0;
     int            font = kDefaultFont;
     float          fontSize = kDefaultFontSize;
 
-    void load(const string& str, int font, float size, float pointSize);
+    void load(str_view_t str, size_t hash, int font, float size, float pointSize);
 
 public:
 
@@ -76,7 +77,7 @@ public:
     void render(const ShaderState* s, float2 pos=float2(0)) const;
 
     // factory
-    static const GLText* get(int font, float size, const string& str);
+    static const GLText* get(int font, float size, str_view_t str);
 
     static float getScaledSize(float sizeUnscaled);
 
@@ -96,7 +97,7 @@ private:
     static const GLText* vget(int font, float size, const char *format, va_list vl) __printflike(3, 0);
 
     static float2 Draw(const ShaderState &s_, float2 p, Align align, int font, uint color,
-                       float sizeUnscaled, const std::string &s);
+                       float sizeUnscaled, str_view_t s);
 
 public:
 
@@ -220,6 +220,23 @@ void TextInputBase::setLines(const vector<string> &lns)
     cursor = int2(lines[lines.size()-1].size(), lines.size()-1);
 }
 
+// word wrap TXT, one string per line. same lines as splitting str_word_wrap(TXT, OPS)
+static vector<string> wrap_lines(const string &txt, const str_wrap_options_t &ops)
+{
+    vector<str_wrap_line_t> layout;
+    str_word_wrap_lines(layout, txt.c_str(), txt.size(), ops);
+
+    vector<string> lines;
+    lines.reserve(layout.size());
+    foreach (const str_wrap_line_t &ln, layout)
+    {
+        lines.push_back(txt.substr(ln.start, ln.end - ln.start));
+        if (ops.rewrap)
+            std::replace(lines.back().begin(), lines.back().end(), '\n', ' ');
+    }
+    return lines;
+}
+
 static void cursor_move_utf8(const string& line, int2& cursor, int adjust)
 {
     cursor.x += adjust;
@@ -449,7 +466,7 @@ void TextInputBase::popText(int chars)
 
 void TextInputBase::pushText(const char *txt, int linesback)
 {
-    vector<string> nlines = str_split('\n', str_word_wrap(txt, sizeChars.x));
+    vector<string> nlines = wrap_lines(txt, str_wrap_options_t(sizeChars.x));
     
     std::lock_guard<std::recursive_mutex> l(mutex);
 
@@ -668,7 +685,7 @@ void TextInputCommandLine::pushCmdOutput(const char *format, ...)
     va_start(vl, format);
     string txt = str_vformat(format, vl);
     va_end(vl);
-    vector<string> nlines = str_split('\n', str_word_wrap(txt, sizeChars.x));
+    vector<string> nlines = wrap_lines(txt, str_wrap_options_t(sizeChars.x));
 
     std::lock_guard<std::recursive_mutex> l(mutex);
     lines.insert(lines.end(), nlines.begin(), nlines.end());
@@ -726,7 +743,7 @@ bool TextInputCommandLine::doCommand(const string& line)
 
         DPRINT(CONSOLE, ("-> '%s'", ot.c_str()));
         
-        const vector<string> nlines = str_split('\n', str_word_wrap(ot, sizeChars.x));
+        const vector<string> nlines = wrap_lines(ot, str_wrap_options_t(sizeChars.x));
         lines.insert(lines.end(), nlines.begin(), nlines.end());
     }
     pushCmdOutput("");      // prompt
@@ -32,6 +32,13 @@ template struct glm::detail::tvec3<int, glm::defaultp>;
 
 #define MYINF std::numeric_limits<float>::max()
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GEOM_SSE2 1
+#else
+#define GEOM_SSE2 0
+#endif
+
 // intersect two circles, returning number of intersections with points in RA and RB
 int intersectCircleCircle(float2 *ra, float2 *rb, const float2 &p, float pr, const float2 &c, float cr)
 {
@@ -90,16 +97,12 @@ bool intersectSegmentSegment(float2 *o, float2 a1, float2 a2, float2 b1, float2
     return intersecting;
 }
 
+template <bool SIMD>
+static int intersectPolySegment_(float2 *outp, const float2 *points, int npoints, float2 sa, float2 sb);
+
 int intersectPolySegment(float2 *outp, const float2 *points, int npoints, float2 sa, float2 sb)
 {
-    int count = 0;
-    for (int i=1; i<npoints; i++) {
-        if (intersectSegmentSegment(&outp[count], points[i-1], points[i], sa, sb))
-            count++;
-    }
-    if (intersectSegmentSegment(&outp[count], points[npoints-1], points[0], sa, sb))
-        count++;
-    return count;
+    return intersectPolySegment_<true>(outp, points, npoints, sa, sb);
 }
 
 
@@ -131,53 +134,422 @@ float incircle(float2 pa, float2 pb, float2 pc, float2 pd)
     return alift * bcdet + blift * cadet + clift * abdet;
 }
 
-// Graham's scan
+int orientSign(float2 a, float2 b, float2 c)
+{
+    // expand the determinant so that every term is a product of two floats, exact in double
+    const double t[6] = { (double)b.x * c.y, -(double)b.x * a.y, -(double)a.x * c.y,
+                          -(double)b.y * c.x, (double)b.y * a.x, (double)a.y * c.x };
+    double det = 0.0;
+    double mag = 0.0;
+    for (int i=0; i<6; i++) {
+        det += t[i];
+        mag += fabs(t[i]);
+    }
+    if (fabs(det) > 8.0 * std::numeric_limits<double>::epsilon() * mag)
+        return det > 0.0 ? 1 : -1;
+
+    // too close to call - sum exactly into a nonoverlapping expansion (Shewchuk's Grow-Expansion)
+    // the largest component has the sign of the sum
+    double e[6];
+    int n = 0;
+    for (int i=0; i<6; i++)
+    {
+        double q = t[i];
+        for (int j=0; j<n; j++)
+        {
+            const double sum = q + e[j];
+            const double bv = sum - q;
+            e[j] = (q - (sum - bv)) + (e[j] - bv);
+            q = sum;
+        }
+        e[n++] = q;
+    }
+    for (int i=n-1; i>=0; i--) {
+        if (e[i] != 0.0)
+            return e[i] > 0.0 ? 1 : -1;
+    }
+    return 0;
+}
+
+template <typename T>
+static bool lessXY(const T &a, const T &b)
+{
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+template <typename T>
+static int convexHull_(T *hull, T *points, int count)
+{
+    if (count < 3)
+        return 0;
+    std::sort(points, points + count, lessXY<T>);
+
+    int M = 0;
+    for (int i=0; i<count; i++)
+    {
+        while (M >= 2 && orientSign(hull[M-2], hull[M-1], points[i]) <= 0)
+            M--;
+        hull[M++] = points[i];
+    }
+    const int lower = M + 1;
+    for (int i=count-2; i>=0; i--)
+    {
+        while (M >= lower && orientSign(hull[M-2], hull[M-1], points[i]) <= 0)
+            M--;
+        hull[M++] = points[i];
+    }
+    M--;                        // first point is repeated at the end
+    return (M < 3) ? 0 : M;
+}
+
+int convexHull(float2 *hull, float2 *points, int count)
+{
+    return convexHull_(hull, points, count);
+}
+
+int convexHull(int2 *hull, int2 *points, int count)
+{
+    return convexHull_(hull, points, count);
+}
+
 int convexHull(vector<float2> &points)
 {
-    if (points.size() < 3)
+    const int N = points.size();
+    if (N < 3)
         return 0;
-    if (points.size() == 3)
-        return 3;
-        
-    float minY  = MYINF;
-    int   minYI = -1;
-    
-    for (int i=0; i<points.size(); i++)
+    points.resize(3 * N);
+    const int M = convexHull(&points[N], &points[0], N);
+    std::copy(points.begin() + N, points.begin() + N + M, points.begin());
+    points.resize(N);
+    return M;
+}
+
+int clipPolyConvex(float2 *outp, float2 *scratch, int maxpoints, const float2 *poly, int npoly,
+                   const float2 *clip, int nclip)
+{
+    // alternate buffers so that the last pass writes OUTP
+    float2 *buf[2] = { outp, scratch };
+    int b = (nclip&1) ? 0 : 1;
+    const float2 *in = poly;
+    int n = npoly;
+    for (int i=0; i<nclip && n > 0; i++)
     {
-        if (points[i].y < minY) {
-            minY = points[i].y;
-            minYI = i;
+        const float2 c1 = clip[i];
+        const float2 c2 = clip[(i+1)%nclip];
+        float2 *out = buf[b];
+        int m = 0;
+        float2 prev = in[n-1];
+        float  oprev = orient(c1, c2, prev);
+        for (int j=0; j<n; j++)
+        {
+            const float2 cur = in[j];
+            const float  ocur = orient(c1, c2, cur);
+            if (m + ((ocur >= 0.f) != (oprev >= 0.f)) + (ocur >= 0.f) > maxpoints)
+                return -1;
+            if ((ocur >= 0.f) != (oprev >= 0.f))
+                out[m++] = lerp(prev, cur, oprev / (oprev - ocur));
+            if (ocur >= 0.f)
+                out[m++] = cur;
+            prev  = cur;
+            oprev = ocur;
         }
+        in = out;
+        n  = m;
+        b  = !b;
     }
-    swap(points[0], points[minYI]);
-    const float2 points0 = points[0];
-    std::sort(points.begin() + 1, points.end(),
-              [points0](float2 a, float2 b)
-              {
-                  return vectorToAngle(a - points0) < vectorToAngle(b - points0);
-              });
-    vector<float2>::iterator nend = std::unique(points.begin(), points.end(),
-                                                [](float2 a, float2 b) { return isZero(a - b); });
-    
-    const size_t N = std::distance(points.begin(), nend);
-    long M = 1;
-    for (int i=1; i<N; i++)
+    if (n && in != outp)
+        std::copy(in, in + n, outp);
+    return n;
+}
+
+// orientSign with polygon B translated by the infinitesimal (e, e^2), so that no vertex of one
+// polygon is exactly on an edge of the other. A1 A2 is an edge of A and P a point of B
+static int orientSignA(float2 a1, float2 a2, float2 p)
+{
+    const int o = orientSign(a1, a2, p);
+    if (o)
+        return o;
+    const float2 d = a2 - a1;
+    return (d.y != 0.f) ? (d.y > 0.f ? -1 : 1) : (d.x > 0.f ? 1 : -1);
+}
+
+// B1 B2 is an edge of B and P a point of A
+static int orientSignB(float2 b1, float2 b2, float2 p)
+{
+    const int o = orientSign(b1, b2, p);
+    if (o)
+        return o;
+    const float2 d = b2 - b1;
+    return (d.y != 0.f) ? (d.y > 0.f ? 1 : -1) : (d.x > 0.f ? -1 : 1);
+}
+
+// point P of polygon A (ISA) or B, inside the other polygon POLY
+static bool insidePerturbed(bool isA, float2 p, const float2 *poly, int n)
+{
+    bool inside = false;
+    for (int i=0, j=n-1; i<n; j=i++)
+    {
+        // B vertices are just above any A vertex at the same height
+        const bool up1 = isA ? (poly[j].y >= p.y) : (poly[j].y > p.y);
+        const bool up2 = isA ? (poly[i].y >= p.y) : (poly[i].y > p.y);
+        if (up1 == up2)
+            continue;
+        const int o = isA ? orientSignB(poly[j], poly[i], p) : orientSignA(poly[j], poly[i], p);
+        if ((o > 0) == up2)
+            inside = !inside;
+    }
+    return inside;
+}
+
+static double orientD(float2 p1, float2 p2, float2 p3)
+{
+    return ((double)p2.x - p1.x) * ((double)p3.y - p1.y) - ((double)p2.y - p1.y) * ((double)p3.x - p1.x);
+}
+
+// order of intersections X and Y on the same edge P1 P2 of polygon P (ISA), crossing edges of polygon Q
+static bool clipVertexLess(const PolyClipVertex &x, const PolyClipVertex &y, bool isA,
+                           float2 p1, float2 p2, const float2 *q, int nq)
+{
+    if (x.alpha != y.alpha)
+        return x.alpha < y.alpha;
+
+    int shared = -1;
+    if ((x.otherEdge + 1) % nq == y.otherEdge)
+        shared = y.otherEdge;
+    else if ((y.otherEdge + 1) % nq == x.otherEdge)
+        shared = x.otherEdge;
+    if (shared < 0)
+        return x.otherEdge < y.otherEdge;
+
+    // the crossing edges share a vertex that (after perturbation) sits just off our edge. Order
+    // by how far along our edge each of them reaches before crossing
+    const float2 s  = q[shared];
+    const float2 ux = q[(x.otherEdge == shared) ? (shared + 1) % nq : x.otherEdge] - s;
+    const float2 uy = q[(y.otherEdge == shared) ? (shared + 1) % nq : y.otherEdge] - s;
+    const double ex = (double)p2.x - p1.x;
+    const double ey = (double)p2.y - p1.y;
+    const double dx = ex * ux.x + ey * ux.y, cx = ex * ux.y - ey * ux.x;
+    const double dy = ex * uy.x + ey * uy.y, cy = ex * uy.y - ey * uy.x;
+    const int h = isA ? orientSignA(p1, p2, s) : orientSignB(p1, p2, s);
+    return (h > 0) ? (dx * cy > dy * cx) : (dx * cy < dy * cx);
+}
+
+// link intersection V into the list of polygon P (ISA), after the vertex starting its edge
+static void clipInsert(PolyClipVertex *nodes, int v, int base, bool isA,
+                       const float2 *p, int np, const float2 *q, int nq)
+{
+    const int e = nodes[v].edge;
+    const int end = base + (e + 1) % np;
+    int cur = base + e;
+    while (nodes[cur].next != end &&
+           clipVertexLess(nodes[nodes[cur].next], nodes[v], isA, p[e], p[(e+1)%np], q, nq))
+    {
+        cur = nodes[cur].next;
+    }
+    nodes[v].prev = cur;
+    nodes[v].next = nodes[cur].next;
+    nodes[nodes[cur].next].prev = v;
+    nodes[cur].next = v;
+}
+
+static void clipMarkEntries(PolyClipVertex *nodes, int base, bool inside)
+{
+    int cur = base;
+    do {
+        if (nodes[cur].neighbor >= 0) {
+            nodes[cur].entry = !inside;
+            inside = !inside;
+        }
+        cur = nodes[cur].next;
+    } while (cur != base);
+}
+
+int clipPolyPoly(float2 *outp, int *outcounts, PolyClipVertex *nodes, int maxnodes,
+                 const float2 *a, int na, const float2 *b, int nb)
+{
+    if (na < 3 || nb < 3)
+        return 0;
+    if (na + nb > maxnodes)
+        return -1;
+
+    for (int i=0; i<na + nb; i++)
     {
-        while (orient(points[M-1], points[M], points[i]) < 0)
+        const bool isA = i < na;
+        const int  n   = isA ? na : nb;
+        const int  j   = isA ? i : i - na;
+        const int  base = isA ? 0 : na;
+        PolyClipVertex &v = nodes[i];
+        v.pos       = isA ? a[j] : b[j];
+        v.next      = base + (j + 1) % n;
+        v.prev      = base + (j + n - 1) % n;
+        v.neighbor  = -1;
+        v.edge      = j;
+        v.otherEdge = -1;
+        v.alpha     = 0.f;
+        v.entry     = false;
+        v.visited   = false;
+    }
+
+    int count = na + nb;
+    for (int i=0; i<na; i++)
+    {
+        const float2 a1 = a[i];
+        const float2 a2 = a[(i+1)%na];
+        for (int j=0; j<nb; j++)
         {
-            if (M > 1)
-                M--;
-            else if (i == N-1)
-                return 0;
-            else
-                i++;
+            const float2 b1 = b[j];
+            const float2 b2 = b[(j+1)%nb];
+            if (orientSignA(a1, a2, b1) == orientSignA(a1, a2, b2) ||
+                orientSignB(b1, b2, a1) == orientSignB(b1, b2, a2))
+                continue;
+            if (count + 2 > maxnodes)
+                return -1;
+
+            const double oa1 = orientD(b1, b2, a1), oa2 = orientD(b1, b2, a2);
+            const double ob1 = orientD(a1, a2, b1), ob2 = orientD(a1, a2, b2);
+            const float alpha = (oa1 != oa2) ? clamp((float) (oa1 / (oa1 - oa2))) : 0.f;
+            const float beta  = (ob1 != ob2) ? clamp((float) (ob1 / (ob1 - ob2))) : 0.f;
+
+            PolyClipVertex &va = nodes[count];
+            PolyClipVertex &vb = nodes[count+1];
+            va.pos       = lerp(a1, a2, alpha);
+            va.neighbor  = count + 1;
+            va.edge      = i;
+            va.otherEdge = j;
+            va.alpha     = alpha;
+            vb.pos       = va.pos;
+            vb.neighbor  = count;
+            vb.edge      = j;
+            vb.otherEdge = i;
+            vb.alpha     = beta;
+            va.entry = vb.entry = va.visited = vb.visited = false;
+
+            clipInsert(nodes, count, 0, true, a, na, b, nb);
+            clipInsert(nodes, count + 1, na, false, b, nb, a, na);
+            count += 2;
         }
-        M++;
-        swap(points[M], points[i]);
     }
-    if (M < 2)
+
+    const bool a0inside = insidePerturbed(true, a[0], b, nb);
+    const bool b0inside = insidePerturbed(false, b[0], a, na);
+    if (count == na + nb)
+    {
+        // no crossings - one contains the other or they are disjoint
+        if (a0inside) {
+            std::copy(a, a + na, outp);
+            outcounts[0] = na;
+            return 1;
+        } else if (b0inside) {
+            std::copy(b, b + nb, outp);
+            outcounts[0] = nb;
+            return 1;
+        }
         return 0;
-    return M+1;
+    }
+
+    clipMarkEntries(nodes, 0, a0inside);
+    clipMarkEntries(nodes, na, b0inside);
+
+    int polys = 0;
+    int m = 0;
+    for (int k=na + nb; k<count; k += 2)
+    {
+        if (nodes[k].visited)
+            continue;
+        const int start = m;
+        int cur = k;
+        do {
+            nodes[cur].visited = nodes[nodes[cur].neighbor].visited = true;
+            const bool forward = nodes[cur].entry;
+            do {
+                outp[m++] = nodes[cur].pos;
+                cur = forward ? nodes[cur].next : nodes[cur].prev;
+            } while (nodes[cur].neighbor < 0);
+            cur = nodes[cur].neighbor;
+        } while (!nodes[cur].visited);
+        outcounts[polys++] = m - start;
+    }
+    return polys;
+}
+
+static int lowestVertex(const float2 *p, int n)
+{
+    int lowest = 0;
+    for (int i=1; i<n; i++) {
+        if (p[i].y < p[lowest].y || (p[i].y == p[lowest].y && p[i].x < p[lowest].x))
+            lowest = i;
+    }
+    return lowest;
+}
+
+int minkowskiSumConvex(float2 *outp, const float2 *a, int na, const float2 *b, int nb)
+{
+    // merge edges of A and B in angle order, starting from the bottom
+    const int ia = lowestVertex(a, na);
+    const int ib = lowestVertex(b, nb);
+    int i = 0, j = 0, m = 0;
+    while (i < na || j < nb)
+    {
+        const float2 pa = a[(ia + i) % na];
+        const float2 pb = b[(ib + j) % nb];
+        outp[m++] = pa + pb;
+        const float c = (i == na) ? -1.f :
+                        (j == nb) ? 1.f :
+                        cross(a[(ia + i + 1) % na] - pa, b[(ib + j + 1) % nb] - pb);
+        if (c >= 0.f)
+            i++;
+        if (c <= 0.f)
+            j++;
+    }
+    return m;
+}
+
+static float distanceSqrToSegment(float2 a, float2 b, float2 p)
+{
+    const float2 ab = b - a;
+    const float  len2 = lengthSqr(ab);
+    const float  t = (len2 > 0.f) ? clamp(dot(p - a, ab) / len2) : 0.f;
+    return distanceSqr(p, a + t * ab);
+}
+
+// keeps points between FIRST and LAST in order, writing them at WRITTEN. Kept points only move
+// backwards, and only over points that have already been visited
+static void simplifyPoly_(float2 *points, int count, int first, int last, float tol2, int *written)
+{
+    const float2 a = points[first];
+    const float2 b = points[last % count];
+    float maxd = tol2;
+    int   maxi = -1;
+    for (int i=first+1; i<last; i++)
+    {
+        const float d = distanceSqrToSegment(a, b, points[i]);
+        if (d > maxd) {
+            maxd = d;
+            maxi = i;
+        }
+    }
+    if (maxi < 0)
+        return;
+    simplifyPoly_(points, count, first, maxi, tol2, written);
+    points[(*written)++] = points[maxi];
+    simplifyPoly_(points, count, maxi, last, tol2, written);
+}
+
+int simplifyPoly(float2 *points, int count, float tolerance)
+{
+    if (count < 3)
+        return count;
+    int far = 1;
+    for (int i=2; i<count; i++) {
+        if (distanceSqr(points[i], points[0]) > distanceSqr(points[far], points[0]))
+            far = i;
+    }
+    const float tol2 = tolerance * tolerance;
+    int written = 1;
+    simplifyPoly_(points, count, 0, far, tol2, &written);
+    points[written++] = points[far];
+    simplifyPoly_(points, count, far, count, tol2, &written);
+    return written;
 }
 
 float momentForPoly(float mass, int numVerts, const float2 *verts, float2 offset)
@@ -381,6 +753,268 @@ float2 rectangleEdge(float2 rpos, float2 rrad, float2 dir)
 }
 
 
+///////////////////////////////////////////// batched intersection
+
+// The batched routines take structure of arrays inputs and test 4 at a time with SSE2. Each lane
+// does exactly the float operations of the scalar function it replaces, so results are
+// identical. They are templates so that mathRunTests can check the SSE paths against the plain
+// scalar loops (SIMD=false)
+
+// smallest float above the (double) parallel threshold in intersectSegmentSegment, so that float
+// compares give the same answer
+static float parallelEpsilon()
+{
+    float eps = 0.00001f;
+    if (eps <= 0.00001)
+        eps = nextafterf(eps, 1.f);
+    return eps;
+}
+
+// position along A of the intersection of segments A and B, or MYINF. same math as intersectSegmentSegment
+static float segmentSegmentParam(float2 a1, float2 a2, float2 b1, float2 b2)
+{
+	const float div = (b2.y - b1.y) * (a2.x - a1.x) - (b2.x - b1.x) * (a2.y - a1.y);
+	if (fabsf(div) < 0.00001)
+		return MYINF; // parallel
+    
+	const float ua = ((b2.x - b1.x) * (a1.y - b1.y) - (b2.y - b1.y) * (a1.x - b1.x)) / div;
+	const float ub = ((a2.x - a1.x) * (a1.y - b1.y) - (a2.y - a1.y) * (a1.x - b1.x)) / div;
+    
+	return ((0 <= ua && ua <= 1) && (0 <= ub && ub <= 1)) ? ua : MYINF;
+}
+
+#if GEOM_SSE2
+
+static inline int hitCount4(__m128 mask)
+{
+    static const int bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    return bits[_mm_movemask_ps(mask)];
+}
+
+static inline __m128 inRange01(__m128 v)
+{
+    return _mm_and_ps(_mm_cmple_ps(_mm_setzero_ps(), v), _mm_cmple_ps(v, _mm_set1_ps(1.f)));
+}
+
+// four lanes of segmentSegmentParam. returns hit mask, position along A in UA
+static inline __m128 segmentSegmentParam4(__m128 *ua,
+                                          __m128 a1x, __m128 a1y, __m128 a2x, __m128 a2y,
+                                          __m128 b1x, __m128 b1y, __m128 b2x, __m128 b2y)
+{
+    static const float eps = parallelEpsilon();
+    const __m128 adx = _mm_sub_ps(a2x, a1x);
+    const __m128 ady = _mm_sub_ps(a2y, a1y);
+    const __m128 bdx = _mm_sub_ps(b2x, b1x);
+    const __m128 bdy = _mm_sub_ps(b2y, b1y);
+    const __m128 abx = _mm_sub_ps(a1x, b1x);
+    const __m128 aby = _mm_sub_ps(a1y, b1y);
+
+    const __m128 div  = _mm_sub_ps(_mm_mul_ps(bdy, adx), _mm_mul_ps(bdx, ady));
+    const __m128 adiv = _mm_andnot_ps(_mm_set1_ps(-0.f), div);
+    const __m128 u    = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(bdx, aby), _mm_mul_ps(bdy, abx)), div);
+    const __m128 v    = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(adx, aby), _mm_mul_ps(ady, abx)), div);
+
+    const __m128 hit = _mm_and_ps(_mm_cmpge_ps(adiv, _mm_set1_ps(eps)),
+                                  _mm_and_ps(inRange01(u), inRange01(v)));
+    *ua = _mm_or_ps(_mm_and_ps(hit, u), _mm_andnot_ps(hit, _mm_set1_ps(MYINF)));
+    return hit;
+}
+
+#endif
+
+template <bool SIMD>
+static int intersectSegmentSegments_(float *ua, float2 a1, float2 a2,
+                                     const float *b1x, const float *b1y, const float *b2x, const float *b2y, int count)
+{
+    int hits = 0;
+    int i = 0;
+#if GEOM_SSE2
+    for (; SIMD && i + 4 <= count; i += 4)
+    {
+        __m128 u;
+        const __m128 hit = segmentSegmentParam4(&u, _mm_set1_ps(a1.x), _mm_set1_ps(a1.y),
+                                                _mm_set1_ps(a2.x), _mm_set1_ps(a2.y),
+                                                _mm_loadu_ps(b1x + i), _mm_loadu_ps(b1y + i),
+                                                _mm_loadu_ps(b2x + i), _mm_loadu_ps(b2y + i));
+        _mm_storeu_ps(ua + i, u);
+        hits += hitCount4(hit);
+    }
+#endif
+    for (; i<count; i++)
+    {
+        ua[i] = segmentSegmentParam(a1, a2, float2(b1x[i], b1y[i]), float2(b2x[i], b2y[i]));
+        if (ua[i] != MYINF)
+            hits++;
+    }
+    return hits;
+}
+
+int intersectSegmentSegments(float *ua, float2 a1, float2 a2,
+                             const float *b1x, const float *b1y, const float *b2x, const float *b2y, int count)
+{
+    return intersectSegmentSegments_<true>(ua, a1, a2, b1x, b1y, b2x, b2y, count);
+}
+
+template <bool SIMD>
+static int intersectPolySegment_(float2 *outp, const float2 *points, int npoints, float2 sa, float2 sb)
+{
+    int count = 0;
+    int i = 1;
+#if GEOM_SSE2
+    // edges points[i-1] -> points[i], four at a time. float2 is packed, so deinterleave x and y
+    for (; SIMD && i + 4 <= npoints; i += 4)
+    {
+        const float* pts = &points[i-1].x;
+        const __m128 lo0 = _mm_loadu_ps(pts);
+        const __m128 hi0 = _mm_loadu_ps(pts + 4);
+        const __m128 lo1 = _mm_loadu_ps(pts + 2);
+        const __m128 hi1 = _mm_loadu_ps(pts + 6);
+        __m128 u;
+        const __m128 hit = segmentSegmentParam4(&u,
+                                                _mm_shuffle_ps(lo0, hi0, _MM_SHUFFLE(2, 0, 2, 0)),
+                                                _mm_shuffle_ps(lo0, hi0, _MM_SHUFFLE(3, 1, 3, 1)),
+                                                _mm_shuffle_ps(lo1, hi1, _MM_SHUFFLE(2, 0, 2, 0)),
+                                                _mm_shuffle_ps(lo1, hi1, _MM_SHUFFLE(3, 1, 3, 1)),
+                                                _mm_set1_ps(sa.x), _mm_set1_ps(sa.y),
+                                                _mm_set1_ps(sb.x), _mm_set1_ps(sb.y));
+        const int mask = _mm_movemask_ps(hit);
+        if (!mask)
+            continue;
+        float ua[4];
+        _mm_storeu_ps(ua, u);
+        for (int j=0; j<4; j++) {
+            if (mask & (1<<j))
+                outp[count++] = lerp(points[i-1+j], points[i+j], ua[j]);
+        }
+    }
+#endif
+    for (; i<npoints; i++) {
+        if (intersectSegmentSegment(&outp[count], points[i-1], points[i], sa, sb))
+            count++;
+    }
+    if (intersectSegmentSegment(&outp[count], points[npoints-1], points[0], sa, sb))
+        count++;
+    return count;
+}
+
+template <bool SIMD>
+static int intersectRayCircles_(bool *hit, float2 *o, float2 E, float2 d,
+                                const float *cx, const float *cy, const float *cr, int count)
+{
+    int hits = 0;
+    int i = 0;
+#if GEOM_SSE2
+    const float2 nd = normalize(d);
+    const __m128 ex = _mm_set1_ps(E.x);
+    const __m128 ey = _mm_set1_ps(E.y);
+    for (; SIMD && i + 4 <= count; i += 4)
+    {
+        const __m128 r  = _mm_loadu_ps(cr + i);
+        const __m128 fx = _mm_sub_ps(ex, _mm_loadu_ps(cx + i));
+        const __m128 fy = _mm_sub_ps(ey, _mm_loadu_ps(cy + i));
+        const __m128 ff = _mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy));
+        const __m128 s  = _mm_add_ps(r, _mm_sqrt_ps(ff));
+        const __m128 dx = _mm_mul_ps(_mm_set1_ps(nd.x), s);
+        const __m128 dy = _mm_mul_ps(_mm_set1_ps(nd.y), s);
+
+        const __m128 a = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 b = _mm_mul_ps(_mm_set1_ps(2.f), _mm_add_ps(_mm_mul_ps(fx, dx), _mm_mul_ps(fy, dy)));
+        const __m128 c = _mm_sub_ps(ff, _mm_mul_ps(r, r));
+        // negative discriminant makes the sqrt NaN, which fails all the range checks
+        const __m128 disc = _mm_sqrt_ps(_mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), a), c)));
+        const __m128 nb   = _mm_xor_ps(b, _mm_set1_ps(-0.f));
+        const __m128 a2   = _mm_mul_ps(_mm_set1_ps(2.f), a);
+        const __m128 t1   = _mm_div_ps(_mm_sub_ps(nb, disc), a2);
+        const __m128 t2   = _mm_div_ps(_mm_add_ps(nb, disc), a2);
+
+        const __m128 h1 = inRange01(t1);
+        const __m128 h  = _mm_or_ps(h1, inRange01(t2));
+        const int mask  = _mm_movemask_ps(h);
+        for (int j=0; j<4; j++)
+            hit[i+j] = (mask>>j)&1;
+        hits += hitCount4(h);
+        if (o && mask)
+        {
+            const __m128 t = _mm_or_ps(_mm_and_ps(h1, t1), _mm_andnot_ps(h1, t2));
+            float ox[4], oy[4];
+            _mm_storeu_ps(ox, _mm_add_ps(ex, _mm_mul_ps(t, dx)));
+            _mm_storeu_ps(oy, _mm_add_ps(ey, _mm_mul_ps(t, dy)));
+            for (int j=0; j<4; j++) {
+                if (hit[i+j])
+                    o[i+j] = float2(ox[j], oy[j]);
+            }
+        }
+    }
+#endif
+    for (; i<count; i++)
+    {
+        hit[i] = intersectRayCircle(o ? &o[i] : NULL, E, d, float2(cx[i], cy[i]), cr[i]);
+        if (hit[i])
+            hits++;
+    }
+    return hits;
+}
+
+int intersectRayCircles(bool *hit, float2 *o, float2 E, float2 d,
+                        const float *cx, const float *cy, const float *cr, int count)
+{
+    return intersectRayCircles_<true>(hit, o, E, d, cx, cy, cr, count);
+}
+
+template <bool SIMD>
+static int intersectPointTriangles_(bool *hit, float2 P, const float *ax, const float *ay,
+                                    const float *bx, const float *by, const float *cx, const float *cy, int count)
+{
+    int hits = 0;
+    int i = 0;
+#if GEOM_SSE2
+    const __m128 px = _mm_set1_ps(P.x);
+    const __m128 py = _mm_set1_ps(P.y);
+    for (; SIMD && i + 4 <= count; i += 4)
+    {
+        const __m128 Ax = _mm_loadu_ps(ax + i);
+        const __m128 Ay = _mm_loadu_ps(ay + i);
+        const __m128 v0x = _mm_sub_ps(_mm_loadu_ps(cx + i), Ax);
+        const __m128 v0y = _mm_sub_ps(_mm_loadu_ps(cy + i), Ay);
+        const __m128 v1x = _mm_sub_ps(_mm_loadu_ps(bx + i), Ax);
+        const __m128 v1y = _mm_sub_ps(_mm_loadu_ps(by + i), Ay);
+        const __m128 v2x = _mm_sub_ps(px, Ax);
+        const __m128 v2y = _mm_sub_ps(py, Ay);
+
+        const __m128 dot00 = _mm_add_ps(_mm_mul_ps(v0x, v0x), _mm_mul_ps(v0y, v0y));
+        const __m128 dot01 = _mm_add_ps(_mm_mul_ps(v0x, v1x), _mm_mul_ps(v0y, v1y));
+        const __m128 dot02 = _mm_add_ps(_mm_mul_ps(v0x, v2x), _mm_mul_ps(v0y, v2y));
+        const __m128 dot11 = _mm_add_ps(_mm_mul_ps(v1x, v1x), _mm_mul_ps(v1y, v1y));
+        const __m128 dot12 = _mm_add_ps(_mm_mul_ps(v1x, v2x), _mm_mul_ps(v1y, v2y));
+
+        const __m128 invDenom = _mm_div_ps(_mm_set1_ps(1.f), _mm_sub_ps(_mm_mul_ps(dot00, dot11), _mm_mul_ps(dot01, dot01)));
+        const __m128 u = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dot11, dot02), _mm_mul_ps(dot01, dot12)), invDenom);
+        const __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dot00, dot12), _mm_mul_ps(dot01, dot02)), invDenom);
+
+        const __m128 h = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmpge_ps(v, _mm_setzero_ps())),
+                                    _mm_cmplt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+        const int mask = _mm_movemask_ps(h);
+        for (int j=0; j<4; j++)
+            hit[i+j] = (mask>>j)&1;
+        hits += hitCount4(h);
+    }
+#endif
+    for (; i<count; i++)
+    {
+        hit[i] = intersectPointTriangle(P, float2(ax[i], ay[i]), float2(bx[i], by[i]), float2(cx[i], cy[i]));
+        if (hit[i])
+            hits++;
+    }
+    return hits;
+}
+
+int intersectPointTriangles(bool *hit, float2 P, const float *ax, const float *ay,
+                            const float *bx, const float *by, const float *cx, const float *cy, int count)
+{
+    return intersectPointTriangles_<true>(hit, P, ax, ay, bx, by, cx, cy, count);
+}
+
+
 // ported from glsl https://github.com/ashima/webgl-noise
 
 using glm::vec2;
@@ -452,6 +1086,179 @@ float snoise(vec2 v)
     return 130.f * dot(m, g);
 }
 
+#if GEOM_SSE2
+
+// floor without SSE4.1. values beyond 2^23 are already integers, and the sign is kept so that
+// floor(-0) is -0 like std::floor
+static inline __m128 floor4(__m128 x)
+{
+    const __m128 sign = _mm_set1_ps(-0.f);
+    const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    const __m128 f = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+    const __m128 big = _mm_cmpge_ps(_mm_andnot_ps(sign, x), _mm_set1_ps(8388608.f));
+    return _mm_or_ps(_mm_and_ps(big, x), _mm_andnot_ps(big, _mm_or_ps(f, _mm_and_ps(x, sign))));
+}
+
+static inline __m128 mod289_4(__m128 x)
+{
+    return _mm_sub_ps(x, _mm_mul_ps(floor4(_mm_mul_ps(x, _mm_set1_ps(1.f / 289.f))), _mm_set1_ps(289.f)));
+}
+
+static inline __m128 permute4(__m128 x)
+{
+    return mod289_4(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(34.f)), _mm_set1_ps(1.f)), x));
+}
+
+// one simplex corner: falloff M (before squaring) and gradient hash P at offset X, Y
+static inline __m128 snoiseCorner4(__m128 m, __m128 p, __m128 x, __m128 y)
+{
+    m = _mm_max_ps(_mm_setzero_ps(), m);
+    m = _mm_mul_ps(m, m);
+    m = _mm_mul_ps(m, m);
+
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 fx = _mm_mul_ps(p, _mm_set1_ps(0.024390243902439f));
+    fx = _mm_sub_ps(fx, floor4(fx));
+    const __m128 gx = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.f), fx), one);
+    const __m128 h  = _mm_sub_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), gx), half);
+    const __m128 a0 = _mm_sub_ps(gx, floor4(_mm_add_ps(gx, half)));
+
+    m = _mm_mul_ps(m, _mm_sub_ps(_mm_set1_ps(1.79284291400159f),
+                                 _mm_mul_ps(_mm_set1_ps(0.85373472095314f),
+                                            _mm_add_ps(_mm_mul_ps(a0, a0), _mm_mul_ps(h, h)))));
+    return _mm_mul_ps(m, _mm_add_ps(_mm_mul_ps(a0, x), _mm_mul_ps(h, y)));
+}
+
+// four lanes of snoise, same operations in the same order
+static __m128 snoise4(__m128 vx, __m128 vy)
+{
+    const __m128 Cx = _mm_set1_ps(0.211324865405187f);
+    const __m128 Cy = _mm_set1_ps(0.366025403784439f);
+    const __m128 Cz = _mm_set1_ps(-0.577350269189626f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    const __m128 s   = _mm_add_ps(_mm_mul_ps(vx, Cy), _mm_mul_ps(vy, Cy));
+    __m128 ix        = floor4(_mm_add_ps(vx, s));
+    __m128 iy        = floor4(_mm_add_ps(vy, s));
+    const __m128 t   = _mm_add_ps(_mm_mul_ps(ix, Cx), _mm_mul_ps(iy, Cx));
+    const __m128 x0x = _mm_add_ps(_mm_sub_ps(vx, ix), t);
+    const __m128 x0y = _mm_add_ps(_mm_sub_ps(vy, iy), t);
+
+    const __m128 gt  = _mm_cmpgt_ps(x0x, x0y);
+    const __m128 i1x = _mm_and_ps(gt, one);
+    const __m128 i1y = _mm_andnot_ps(gt, one);
+
+    const __m128 x1x = _mm_sub_ps(_mm_add_ps(x0x, Cx), i1x);
+    const __m128 x1y = _mm_sub_ps(_mm_add_ps(x0y, Cx), i1y);
+    const __m128 x2x = _mm_add_ps(x0x, Cz);
+    const __m128 x2y = _mm_add_ps(x0y, Cz);
+
+    ix = mod289_4(ix);
+    iy = mod289_4(iy);
+    const __m128 p0 = permute4(_mm_add_ps(_mm_add_ps(permute4(_mm_add_ps(iy, zero)), ix), zero));
+    const __m128 p1 = permute4(_mm_add_ps(_mm_add_ps(permute4(_mm_add_ps(iy, i1y)), ix), i1x));
+    const __m128 p2 = permute4(_mm_add_ps(_mm_add_ps(permute4(_mm_add_ps(iy, one)), ix), one));
+
+    const __m128 m0 = _mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x0x, x0x), _mm_mul_ps(x0y, x0y)));
+    const __m128 m1 = _mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x1x, x1x), _mm_mul_ps(x1y, x1y)));
+    const __m128 m2 = _mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x2x, x2x), _mm_mul_ps(x2y, x2y)));
+
+    const __m128 r = _mm_add_ps(_mm_add_ps(snoiseCorner4(m0, p0, x0x, x0y),
+                                           snoiseCorner4(m1, p1, x1x, x1y)),
+                                snoiseCorner4(m2, p2, x2x, x2y));
+    return _mm_mul_ps(_mm_set1_ps(130.f), r);
+}
+
+// deinterleave four float2
+static inline void loadPoints4(__m128 *x, __m128 *y, const float2 *points)
+{
+    const __m128 lo = _mm_loadu_ps(&points[0].x);
+    const __m128 hi = _mm_loadu_ps(&points[2].x);
+    *x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    *y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+#endif
+
+template <bool SIMD>
+static void snoise_(float *out, const float2 *points, int count)
+{
+    int i = 0;
+#if GEOM_SSE2
+    for (; SIMD && i + 4 <= count; i += 4)
+    {
+        __m128 x, y;
+        loadPoints4(&x, &y, points + i);
+        _mm_storeu_ps(out + i, snoise4(x, y));
+    }
+#endif
+    for (; i<count; i++)
+        out[i] = snoise(points[i]);
+}
+
+void snoise(float *out, const float2 *points, int count)
+{
+    snoise_<true>(out, points, count);
+}
+
+float fbm(float2 v, int octaves, float lacunarity, float gain)
+{
+    if (octaves <= 0)
+        return 0.f;
+    float sum = 0.f;
+    float amp = 1.f;
+    float total = 0.f;
+    for (int i=0; i<octaves; i++)
+    {
+        sum   += amp * snoise(v);
+        total += amp;
+        v     *= lacunarity;
+        amp   *= gain;
+    }
+    return sum / total;
+}
+
+template <bool SIMD>
+static void fbm_(float *out, const float2 *points, int count, int octaves, float lacunarity, float gain)
+{
+    if (octaves <= 0) {
+        std::fill(out, out + count, 0.f);
+        return;
+    }
+    int i = 0;
+#if GEOM_SSE2
+    // all octaves for four points at a time, in registers
+    const __m128 lac = _mm_set1_ps(lacunarity);
+    for (; SIMD && i + 4 <= count; i += 4)
+    {
+        __m128 x, y;
+        loadPoints4(&x, &y, points + i);
+        __m128 sum = _mm_setzero_ps();
+        float amp = 1.f;
+        float total = 0.f;
+        for (int j=0; j<octaves; j++)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amp), snoise4(x, y)));
+            total += amp;
+            x = _mm_mul_ps(x, lac);
+            y = _mm_mul_ps(y, lac);
+            amp *= gain;
+        }
+        _mm_storeu_ps(out + i, _mm_div_ps(sum, _mm_set1_ps(total)));
+    }
+#endif
+    for (; i<count; i++)
+        out[i] = fbm(points[i], octaves, lacunarity, gain);
+}
+
+void fbm(float *out, const float2 *points, int count, int octaves, float lacunarity, float gain)
+{
+    fbm_<true>(out, points, count, octaves, lacunarity, gain);
+}
+
 #include "RGB.h"
 
 bool mathRunTests()
@@ -468,7 +1275,137 @@ bool mathRunTests()
         DASSERT(floor_int(x) == (int) floor(x));
         DASSERT(ceil_int(x) == (int) ceil(x));
     }
-    
+
+    // batched intersection must match the scalar versions exactly
+    {
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<float> dist(-10.f, 10.f);
+        static const int kCount = 67;
+        float v[6][kCount];
+        float2 poly[kCount];
+        for (int i=0; i<kCount; i++) {
+            for (int j=0; j<6; j++)
+                v[j][i] = dist(gen);
+            v[4][i] = fabsf(v[4][i]);
+            poly[i] = float2(v[0][i], v[1][i]);
+        }
+
+        for (int k=0; k<8; k++)
+        {
+            const float2 a = float2(dist(gen), dist(gen));
+            const float2 b = float2(dist(gen), dist(gen));
+
+            float ua[2][kCount];
+            DASSERT(intersectSegmentSegments_<true>(ua[0], a, b, v[0], v[1], v[2], v[3], kCount) ==
+                    intersectSegmentSegments_<false>(ua[1], a, b, v[0], v[1], v[2], v[3], kCount));
+            for (int i=0; i<kCount; i++)
+                DASSERT(ua[0][i] == ua[1][i]);
+
+            float2 pp[2][kCount];
+            const int npp = intersectPolySegment_<true>(pp[0], poly, kCount, a, b);
+            DASSERT(npp == intersectPolySegment_<false>(pp[1], poly, kCount, a, b));
+            for (int i=0; i<npp; i++)
+                DASSERT(pp[0][i] == pp[1][i]);
+
+            bool hit[2][kCount];
+            float2 o[2][kCount];
+            DASSERT(intersectRayCircles_<true>(hit[0], o[0], a, b, v[0], v[1], v[4], kCount) ==
+                    intersectRayCircles_<false>(hit[1], o[1], a, b, v[0], v[1], v[4], kCount));
+            for (int i=0; i<kCount; i++)
+                DASSERT(hit[0][i] == hit[1][i] && (!hit[0][i] || o[0][i] == o[1][i]));
+
+            DASSERT(intersectPointTriangles_<true>(hit[0], a, v[0], v[1], v[2], v[3], v[4], v[5], kCount) ==
+                    intersectPointTriangles_<false>(hit[1], a, v[0], v[1], v[2], v[3], v[4], v[5], kCount));
+            for (int i=0; i<kCount; i++)
+                DASSERT(hit[0][i] == hit[1][i]);
+        }
+    }
+
+    // hulls and clipping
+    {
+        DASSERT(orientSign(float2(0.1f, 0.1f), float2(1e7f, 1e7f), float2(3.3f, 3.3f)) == 0);
+        DASSERT(orientSign(float2(0.f), float2(1.f, 1.f), float2(0.5f, nextafterf(0.5f, 1.f))) == 1);
+
+        float2 grid[25], hull[50];
+        int2 igrid[25], ihull[50];
+        for (int i=0; i<25; i++) {
+            grid[i] = float2(0.1f * (i%5), 0.1f * (i/5));
+            igrid[i] = int2(i%5, i/5);
+        }
+        DASSERT(convexHull(hull, grid, 25) == 4);
+        DASSERT(convexHull(ihull, igrid, 25) == 4);
+        DASSERT(convexHull(hull, grid, 5) == 0);
+
+        const float2 sq[] = { float2(0, 0), float2(1, 0), float2(1, 1), float2(0, 1) };
+        const float2 sq2[] = { float2(0.5f, 0.5f), float2(1.5f, 0.5f), float2(1.5f, 1.5f), float2(0.5f, 1.5f) };
+        const float2 right[] = { float2(1, 0), float2(2, 0), float2(2, 1), float2(1, 1) };
+        const float2 ushape[] = { float2(0, 0), float2(3, 0), float2(3, 3), float2(2, 3),
+                                  float2(2, 1), float2(1, 1), float2(1, 3), float2(0, 3) };
+        const float2 bar[] = { float2(-1, 2), float2(4, 2), float2(4, 2.5f), float2(-1, 2.5f) };
+
+        float2 outp[64], scratch[64];
+        int counts[32];
+        PolyClipVertex nodes[64];
+        DASSERT(clipPolyConvex(outp, scratch, 64, sq2, 4, sq, 4) == 4);
+        DASSERT(isZero(fabsf(areaForPoly(4, outp)) - 0.25f));
+
+        // a concave sawtooth cut by a bar through its teeth gains a point per crossing
+        float2 saw[23];
+        for (int i=0; i<21; i++)
+            saw[i] = float2((float)i, (i&1) ? 2.f : 0.f);
+        saw[21] = float2(20, -1);
+        saw[22] = float2(0, -1);
+        const float2 band[] = { float2(-1, 0.5f), float2(21, 0.5f), float2(21, 1.5f), float2(-1, 1.5f) };
+        DASSERT(clipPolyConvex(outp, scratch, 27, saw, 23, band, 4) == -1);
+        const int nsaw = clipPolyConvex(outp, scratch, 64, saw, 23, band, 4);
+        DASSERT(nsaw == 40 && isZero(fabsf(areaForPoly(nsaw, outp)) - 10.f));
+        DASSERT(clipPolyPoly(outp, counts, nodes, 64, sq2, 4, sq, 4) == 1 && counts[0] == 4);
+        DASSERT(isZero(fabsf(areaForPoly(4, outp)) - 0.25f));
+        DASSERT(clipPolyPoly(outp, counts, nodes, 64, sq, 4, sq, 4) == 1);
+        DASSERT(isZero(fabsf(areaForPoly(counts[0], outp)) - 1.f));
+        const int touching = clipPolyPoly(outp, counts, nodes, 64, sq, 4, right, 4);
+        DASSERT(touching <= 1 && (touching == 0 || isZero(areaForPoly(counts[0], outp))));
+        DASSERT(clipPolyPoly(outp, counts, nodes, 64, ushape, 8, bar, 4) == 2);
+        DASSERT(isZero(fabsf(areaForPoly(counts[0], outp)) - 0.5f) &&
+                isZero(fabsf(areaForPoly(counts[1], outp + counts[0])) - 0.5f));
+        DASSERT(clipPolyPoly(outp, counts, nodes, 8, ushape, 8, bar, 4) == -1);
+
+        DASSERT(minkowskiSumConvex(outp, sq, 4, sq, 4) == 4);
+        DASSERT(isZero(fabsf(areaForPoly(4, outp)) - 4.f));
+
+        float2 octo[8];
+        for (int i=0; i<4; i++) {
+            octo[2*i] = sq[i];
+            octo[2*i+1] = 0.5f * (sq[i] + sq[(i+1)%4]);
+        }
+        DASSERT(simplifyPoly(octo, 8, 0.01f) == 4);
+        for (int i=0; i<4; i++)
+            DASSERT(octo[i] == sq[i]);
+    }
+
+    // batched noise must match snoise exactly
+    {
+        std::mt19937 gen(2);
+        std::uniform_real_distribution<float> dist(-1000.f, 1000.f);
+        static const int kCount = 131;
+        float2 pts[kCount];
+        for (int i=0; i<kCount; i++)
+            pts[i] = (i < 32) ? float2(i - 16, 16 - 2 * i) : float2(dist(gen), dist(gen));
+        float n[2][kCount];
+        snoise_<true>(n[0], pts, kCount);
+        snoise_<false>(n[1], pts, kCount);
+        for (int i=0; i<kCount; i++)
+            DASSERT(n[0][i] == n[1][i]);
+        fbm_<true>(n[0], pts, kCount, 5, 2.f, 0.5f);
+        fbm_<false>(n[1], pts, kCount, 5, 2.f, 0.5f);
+        for (int i=0; i<kCount; i++)
+            DASSERT(n[0][i] == n[1][i] && -1.f <= n[0][i] && n[0][i] <= 1.f);
+        fbm_<true>(n[0], pts, kCount, 0, 2.f, 0.5f);
+        for (int i=0; i<kCount; i++)
+            DASSERT(n[0][i] == 0.f);
+        DASSERT(fbm(pts[0], 0) == 0.f && fbm(pts[0], -1) == 0.f);
+    }
+
     return true;
 }
 
@@ -658,6 +658,14 @@ inline float bellcurve(float x)
 // perlin/simplex noise, range is [-1 to 1]
 float snoise(float2 v);
 
+// snoise for COUNT points at once, OUT[i] = snoise(POINTS[i]) exactly
+void snoise(float *out, const float2 *points, int count);
+
+// fractal brownian motion - OCTAVES of snoise at increasing frequency, range is [-1 to 1]
+// 0 if OCTAVES <= 0
+float fbm(float2 v, int octaves, float lacunarity=2.f, float gain=0.5f);
+void fbm(float *out, const float2 *points, int count, int octaves, float lacunarity=2.f, float gain=0.5f);
+
 // 
 inline float gaussian(float x, float stdev=1.f)
 {
@@ -749,6 +757,11 @@ bool intersectSegmentSegment(float2 *o, float2 a1, float2 a2, float2 b1, float2
 // return count, up to two points in OUTP
 int intersectPolySegment(float2 *outp, const float2 *points, int npoints, float2 sa, float2 sb);
 
+// intersect segment A1 A2 against COUNT segments B1 B2 (structure of arrays), 4 at a time
+// UA[i] is the position along A of the intersection with segment i, or FLT_MAX. return number of hits
+int intersectSegmentSegments(float *ua, float2 a1, float2 a2,
+                             const float *b1x, const float *b1y, const float *b2x, const float *b2y, int count);
+
 // distance from point P to closest point on line A B
 // FIXME could probably do this with only one sqrt...
 inline float perpendicularDistance(float2 a, float2 b, float2 p)
@@ -787,9 +800,61 @@ inline float orient2(float2 p2, float2 p3)
 /*               order, or the sign of the result will be reversed.          */
 float incircle(float2 pa, float2 pb, float2 pc, float2 pd);
 
-// Graham's scan
+// sign of orient(), computed exactly. never wrong about collinear or nearly collinear points
+int orientSign(float2 p1, float2 p2, float2 p3);
+
+// coordinates must be within +-(2^30 - 1), so that the determinant fits in an int64
+inline int orientSign(int2 p1, int2 p2, int2 p3)
+{
+    const int64 o = ((int64)p2.x - p1.x) * ((int64)p3.y - p1.y) - ((int64)p2.y - p1.y) * ((int64)p3.x - p1.x);
+    return (o > 0) - (o < 0);
+}
+
+// Andrew's monotone chain, using exact predicates
+// sorts POINTS and writes the counterclockwise hull to HULL, which needs room for 2 * COUNT points.
+// points on the hull edges are dropped (the old Graham scan kept collinear points), so callers
+// only get corners. return hull size, or 0 if degenerate
+int convexHull(float2 *hull, float2 *points, int count);
+int convexHull(int2 *hull, int2 *points, int count);
+
+// hull in the first (returned count) elements of POINTS. Size is unchanged, but POINTS is grown to
+// 3x its size for scratch space, which allocates unless the capacity is already there - use the
+// pointer version with a reused buffer in hot loops
 int convexHull(vector<float2> &points);
 
+// clip POLY against counterclockwise convex polygon CLIP (Sutherland-Hodgman)
+// OUTP and SCRATCH each have room for MAXPOINTS points. NPOLY + NCLIP is enough for convex POLY.
+// POLY may be concave, but then each clip edge can add up to NPOLY / 2 points.
+// return point count, or -1 if MAXPOINTS is too small
+int clipPolyConvex(float2 *outp, float2 *scratch, int maxpoints, const float2 *poly, int npoly,
+                   const float2 *clip, int nclip);
+
+// scratch space for clipPolyPoly
+struct PolyClipVertex {
+    float2 pos;
+    int    next, prev;
+    int    neighbor;            // same intersection in the other polygon, or -1 for vertices
+    int    edge, otherEdge;
+    float  alpha;               // position along edge
+    bool   entry, visited;
+};
+
+// intersection of simple polygons A and B, of either winding (Greiner-Hormann)
+// degenerate cases are handled by treating B as infinitesimally offset, so touching edges and
+// shared vertices never produce spurious pieces
+// result polygons are written consecutively to OUTP, point counts to OUTCOUNTS. NODES needs at
+// least NA + NB + 2 * (number of edge crossings). OUTP needs room for MAXNODES points, OUTCOUNTS for
+// MAXNODES / 2. return number of polygons, or -1 if MAXNODES is too small
+int clipPolyPoly(float2 *outp, int *outcounts, PolyClipVertex *nodes, int maxnodes,
+                 const float2 *a, int na, const float2 *b, int nb);
+
+// minkowski sum of counterclockwise convex polygons. OUTP needs room for NA + NB points. return point count
+int minkowskiSumConvex(float2 *outp, const float2 *a, int na, const float2 *b, int nb);
+
+// remove vertices of closed polygon POINTS within TOLERANCE of the simplified outline, in place
+// (Ramer-Douglas-Peucker). return new count
+int simplifyPoly(float2 *points, int count, float tolerance);
+
 inline float areaForPoly(const int numVerts, const float2 *verts)
 {
 	double area = 0.0;
@@ -868,6 +933,10 @@ inline bool intersectRayCircle(const float2 &a, float2 d, const float2 &c, float
 // circle is at point C with radius r
 bool intersectRayCircle(float2 *o, float2 E, float2 d, float2 C, float r);
 
+// intersectRayCircle against COUNT circles. sets HIT[i] and O[i] (if O non-null), return number of hits
+int intersectRayCircles(bool *hit, float2 *o, float2 E, float2 d,
+                        const float *cx, const float *cy, const float *cr, int count);
+
 inline bool intersectRaySegment(float2 rpt, float2 rdir, float2 sa, float2 sb)
 {
     float t = ((rdir.x * rpt.y + rdir.y * (sa.x - rpt.x)) - (rdir.x * sb.y)) / 
@@ -1042,6 +1111,10 @@ float2 rectangleEdge(float2 rpos, float2 rrad, float2 dir);
 // from http://www.blackpawn.com/texts/pointinpoly/
 bool intersectPointTriangle(float2 P, float2 A, float2 B, float2 C);
 
+// intersectPointTriangle against COUNT triangles. sets HIT[i], return number of hits
+int intersectPointTriangles(bool *hit, float2 P, const float *ax, const float *ay,
+                            const float *bx, const float *by, const float *cx, const float *cy, int count);
+
 // quad points must have clockwise winding
 inline bool intersectPointQuad(float2 P, float2 A, float2 B, float2 C, float2 D)
 {
@@ -232,12 +232,23 @@ void OL_OnTerminate(const char* message);
 // load text file into memory. pointer does not need to be freed, but is reused across calls
 const char *OL_LoadFile(const char *fname);
 
+// like OL_LoadFile, but memory mapped where possible instead of copied. *size is set to the file length.
+// not necessarily null terminated. valid until OL_ThreadEndIteration
+const char *OL_LoadFileView(const char *fname, size_t *size);
+
+// map file read only. returns NULL if the file can't be mapped (or mapping is not supported)
+// files smaller than MINSIZE are cheaper to read than to map, and also return NULL
+// release with OL_UnmapFile
+const char *OL_MapFile(const char *fname, size_t *size, size_t minsize);
+void OL_UnmapFile(const char *data, size_t size);
+
 // write text file to disk, atomically. Creates directories as needed.
 int OL_SaveFile(const char* fname, const char* data, int size);
 
 int OL_CopyFile(const char* source, const char *dest);
 
-// Return list of files in a directory (base name only - no path)
+// Return sorted, NULL terminated list of files in a directory (base name only - no path)
+// merges the save and package directories. Thread safe, valid until the end of the frame
 const char** OL_ListDirectory(const char* path);
 
 int OL_DirectoryExists(const char* path);
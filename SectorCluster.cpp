@@ -0,0 +1,270 @@
+
+#include "StdAfx.h"
+#include "SectorCluster.h"
+
+#if WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const size_t kHeaderSize = 4 + SectorCluster::kMaxSectors * sizeof(SectorCluster::Entry);
+
+static size_t entryOffset(size_t index)
+{
+    return 4 + index * sizeof(SectorCluster::Entry);
+}
+
+static FILE *openFile(const char* abspath, const char* mode)
+{
+#if WIN32
+    return _wfopen(s2ws(abspath).c_str(), s2ws(mode).c_str());
+#else
+    return fopen(abspath, mode);
+#endif
+}
+
+static bool writeAt(FILE *f, size_t offset, const void* data, size_t size)
+{
+    return fseek(f, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, size, f) == size;
+}
+
+// make sure everything written so far hits the disk before anything written after
+static bool syncFile(FILE *f)
+{
+#if WIN32
+    return fflush(f) == 0 && _commit(_fileno(f)) == 0;
+#else
+    return fflush(f) == 0 && fsync(fileno(f)) == 0;
+#endif
+}
+
+// write a complete cluster of already compressed sectors, atomically
+static bool writeCluster(const char* abspath, const vector< pair<int2, string> > &zsectors)
+{
+    if (zsectors.size() > SectorCluster::kMaxSectors) {
+        Reportf("Too many sectors for cluster '%s': %d", abspath, (int)zsectors.size());
+        return false;
+    }
+
+    string data(kHeaderSize, '\0');
+    const int32 count = zsectors.size();
+    memcpy(&data[0], &count, sizeof(count));
+    for (size_t i=0; i<zsectors.size(); i++)
+    {
+        const string &zdata = zsectors[i].second;
+        SectorCluster::Entry entry;
+        entry.x        = zsectors[i].first.x;
+        entry.y        = zsectors[i].first.y;
+        entry.offset   = data.size();
+        entry.size     = zdata.size();
+        entry.reserved = zdata.size();
+        memcpy(&data[entryOffset(i)], &entry, sizeof(entry));
+        data += zdata;
+    }
+
+    return ZF_SaveFileAtomic(abspath, data.data(), data.size());
+}
+
+bool SectorCluster::open(const char* path)
+{
+    close();
+    m_path = path;
+
+    ZFView data = ZF_LoadFileView(path);
+    if (data.size < 4)
+        return false;
+
+    int32 count = 0;
+    memcpy(&count, data.data, sizeof(count));
+    if (count < 0 || count > kMaxSectors || entryOffset(count) > data.size) {
+        Reportf("Corrupt sector cluster '%s': %d sectors in %d bytes", path, count, (int)data.size);
+        return false;
+    }
+
+    m_entries.resize(count);
+    memcpy(&m_entries[0], data.data + 4, count * sizeof(Entry));
+    for (int i=0; i<count; i++)
+    {
+        const Entry &e = m_entries[i];
+        if (e.offset < 0 || e.size < 0 || e.offset + (size_t)e.size > data.size) {
+            Reportf("Corrupt sector cluster '%s': sector %d {%d, %d} at %d+%d past end (%d)",
+                    path, i, e.x, e.y, e.offset, e.size, (int)data.size);
+            close();
+            return false;
+        }
+        m_index[int2(e.x, e.y)] = i;
+    }
+    m_data = std::move(data);
+    return true;
+}
+
+void SectorCluster::close()
+{
+    m_data = ZFView();
+    m_entries.clear();
+    m_index.clear();
+}
+
+const SectorCluster::Entry *SectorCluster::find(int2 pos) const
+{
+    std::unordered_map<int2, int>::const_iterator it = m_index.find(pos);
+    return (it != m_index.end()) ? &m_entries[it->second] : NULL;
+}
+
+str_view_t SectorCluster::getCompressed(int2 pos) const
+{
+    const Entry *e = find(pos);
+    return e ? str_view_t(m_data.data + e->offset, e->size) : str_view_t();
+}
+
+string SectorCluster::load(int2 pos) const
+{
+    const str_view_t zdata = getCompressed(pos);
+    return ZF_Decompress(zdata.ptr, zdata.len);
+}
+
+vector<string> SectorCluster::load(const vector<int2> &sectors) const
+{
+    vector<string> data(sectors.size());
+    ZF_ParallelFor(sectors.size(), NULL, [&](int i) { data[i] = load(sectors[i]); });
+    return data;
+}
+
+// append a new slot for the sector if the header has room, then point its entry at it
+// the data is synced before the entry and the count are written, and the old slot is left alone, so
+// an interrupted save leaves the file with either the old or the new version of the sector
+// returns false with the cluster untouched if there is no room. Otherwise the file is unmapped
+// before writing, and the caller has to reopen it
+bool SectorCluster::saveAppend(const char* abspath, int2 pos, const string &zdata)
+{
+    const Entry *e = find(pos);
+    const size_t index = e ? (e - &m_entries[0]) : m_entries.size();
+
+    size_t dataStart = m_data.size;
+    size_t live = 0;
+    foreach (const Entry &e1, m_entries)
+    {
+        dataStart = min(dataStart, (size_t)e1.offset);
+        live += e1.capacity();
+    }
+    if (entryOffset(index + 1) > dataStart)
+        return false;           // no room in header
+    // don't let abandoned slots pile up - rewrite instead
+    const size_t wasted = m_data.size - dataStart - live + (e ? e->capacity() : 0);
+    if (wasted > m_data.size / 2)
+        return false;
+
+    Entry entry;
+    entry.x        = pos.x;
+    entry.y        = pos.y;
+    entry.offset   = m_data.size;
+    entry.size     = zdata.size();
+    entry.reserved = zdata.size();
+
+    // don't write underneath our own mapping
+    m_data = ZFView();
+
+    FILE *f = openFile(abspath, "r+b");
+    if (!f) {
+        Reportf("Error opening '%s' for update: %s", abspath, strerror(errno));
+        return false;
+    }
+    const int32 count = max(index + 1, m_entries.size());
+    bool success = writeAt(f, entry.offset, zdata.data(), zdata.size()) &&
+                   syncFile(f) &&
+                   writeAt(f, entryOffset(index), &entry, sizeof(entry)) &&
+                   writeAt(f, 0, &count, sizeof(count));
+    success = (fclose(f) == 0) && success;
+    if (!success)
+        Reportf("Error updating sector {%d, %d} in '%s': %s", pos.x, pos.y, abspath, strerror(errno));
+    return success;
+}
+
+bool SectorCluster::save(int2 pos, const char* data, size_t size)
+{
+    const string zdata = ZF_Compress(data, size);
+    if (zdata.empty())
+        return false;
+
+    // only append if we are writing the same file we mapped
+    const string abspath = OL_PathForFile(m_path.c_str(), "w");
+    if (isOpen() && abspath == OL_PathForFile(m_path.c_str(), "r"))
+    {
+        const bool appended = saveAppend(abspath.c_str(), pos, zdata);
+        if (!isOpen())
+            return open(m_path.c_str()) && appended;
+    }
+
+    vector< pair<int2, string> > zsectors;
+    foreach (const Entry &e, m_entries)
+    {
+        const int2 epos(e.x, e.y);
+        if (epos != pos)
+            zsectors.push_back(make_pair(epos, getCompressed(epos).str()));
+    }
+    zsectors.push_back(make_pair(pos, zdata));
+
+    close();                    // can't replace a mapped file on windows
+    const bool success = writeCluster(abspath.c_str(), zsectors);
+    open(m_path.c_str());
+    return success;
+}
+
+bool SectorCluster::write(const char* path, const vector< pair<int2, string> > &sectors)
+{
+    vector< pair<int2, string> > zsectors(sectors.size());
+    ZF_ParallelFor(sectors.size(), NULL, [&](int i) {
+        zsectors[i].first = sectors[i].first;
+        zsectors[i].second = ZF_Compress(sectors[i].second.data(), sectors[i].second.size());
+    });
+    return writeCluster(OL_PathForFile(path, "w"), zsectors);
+}
+
+bool sectorClusterRunTests()
+{
+    if (!IS_DEBUG)
+        return true;
+    static const char* kPath = "sector_cluster_test.dat";
+
+    vector< pair<int2, string> > sectors;
+    for (int i=0; i<40; i++)
+        sectors.push_back(make_pair(int2(i % 7, i / 7), str_format("sector %d ", i) + string(i * 100, 'a' + i % 26)));
+    DASSERT(SectorCluster::write(kPath, sectors));
+
+    {
+        SectorCluster sc(kPath);
+        DASSERT(sc.isOpen() && sc.getEntries().size() == sectors.size());
+        for (size_t i=0; i<sectors.size(); i++)
+            DASSERT(sc.load(sectors[i].first) == sectors[i].second);
+        DASSERT(sc.load(int2(100, 100)).empty());
+
+        // replace smaller and larger, add a new sector, then enough saves to force a rewrite
+        string big;
+        for (int i=0; i<5000; i++)
+            str_append_format(big, "%d,", i);
+        DASSERT(sc.save(int2(1, 0), "short", 5));
+        DASSERT(sc.save(int2(2, 0), big.data(), big.size()));
+        DASSERT(sc.save(int2(50, 50), "new", 3));
+        for (int i=0; i<20; i++)
+        {
+            const string data = str_format("%d", i) + big;
+            DASSERT(sc.save(int2(3, 0), data.data(), data.size()));
+            DASSERT(sc.load(int2(3, 0)) == data);
+        }
+        sectors[1].second = "short";
+        sectors[2].second = big;
+        sectors[3].second = str_format("%d", 19) + big;
+        sectors.push_back(make_pair(int2(50, 50), string("new")));
+    }
+
+    // everything survives reopening the file
+    SectorCluster sc(kPath);
+    DASSERT(sc.getEntries().size() == sectors.size());
+    for (size_t i=0; i<sectors.size(); i++)
+        DASSERT(sc.load(sectors[i].first) == sectors[i].second);
+    sc.close();
+
+    OL_RemoveFileOrDirectory(kPath);
+    return true;
+}
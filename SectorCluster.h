@@ -0,0 +1,71 @@
+
+#ifndef SECTORCLUSTER_H
+#define SECTORCLUSTER_H
+
+#include "ZipFile.h"
+
+// random access to clustered sector files (see scripts/decluster.py)
+// everything is little endian int32:
+//   count
+//   count x {x, y, offset, size, reserved}
+//   gzipped sector data
+// size is the compressed size of a sector and reserved the number of bytes available for it at
+// offset. Clusters written here leave room in the header for kMaxSectors entries, so most saves
+// append one slot and then update one header entry.
+
+class SectorCluster {
+public:
+    static const int kMaxSectors = 256;
+
+    struct Entry {
+        int32 x, y;
+        int32 offset;
+        int32 size;
+        int32 reserved;
+
+        int capacity() const { return max(size, reserved); }
+    };
+
+private:
+    string                        m_path;
+    ZFView                        m_data;
+    vector<Entry>                 m_entries;
+    std::unordered_map<int2, int> m_index;
+
+    const Entry *find(int2 pos) const;
+    bool saveAppend(const char* abspath, int2 pos, const string &zdata);
+
+public:
+
+    SectorCluster() {}
+    explicit SectorCluster(const char* path) { open(path); }
+
+    // map cluster file, relative to game directory. false if missing or corrupt
+    bool open(const char* path);
+    void close();
+
+    bool isOpen() const { return m_data.data != NULL; }
+    const string &getPath() const { return m_path; }
+    const vector<Entry> &getEntries() const { return m_entries; }
+
+    bool contains(int2 pos) const { return find(pos) != NULL; }
+
+    // gzipped sector data, straight out of the mapping
+    str_view_t getCompressed(int2 pos) const;
+
+    // decompressed sector data, or "" if not present
+    string load(int2 pos) const;
+
+    // decompress several sectors at once on the zip worker threads
+    vector<string> load(const vector<int2> &sectors) const;
+
+    // compress and store sector data, appending to the file if possible and rewriting it otherwise
+    bool save(int2 pos, const char* data, size_t size);
+
+    // write a new cluster containing SECTORS (uncompressed)
+    static bool write(const char* path, const vector< pair<int2, string> > &sectors);
+};
+
+bool sectorClusterRunTests();
+
+#endif
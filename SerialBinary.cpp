@@ -0,0 +1,147 @@
+
+#include "StdAfx.h"
+#include "SerialBinary.h"
+
+// test structs for serialRunTests
+
+#define SERIAL_TEST_SHAPES(F) F(SQUARE, 1) F(OCTAGON, 2) F(TRIANGLE, 4)
+DEFINE_ENUM(uint, SerialTestShape, SERIAL_TEST_SHAPES);
+
+#define SERIAL_TEST_INNER_FIELDS(F)                         \
+    F(int,             a,     3)                            \
+    F(string,          s,     "hi")                         \
+    F(SerialTestShape, shape, SerialTestShape::SQUARE)      \
+
+DECLARE_SERIAL_STRUCT(SerialTestInner, SERIAL_TEST_INNER_FIELDS);
+DEFINE_SERIAL_STRUCT(SerialTestInner, SERIAL_TEST_INNER_FIELDS);
+
+inline bool operator!=(const SerialTestInner& a, const SerialTestInner& b) { return !(a == b); }
+
+typedef std::map<string, int> SerialTestCounts;
+
+#define SERIAL_TEST_FIELDS(F)                               \
+    F(uint,                    ident,  0)                   \
+    F(float2,                  offset, float2(0))           \
+    F(float,                   angle,  0.f)                 \
+    F(vector<float2>,          verts,  vector<float2>())    \
+    F(vector<SerialTestInner>, inners, vector<SerialTestInner>()) \
+    F(SerialTestInner,         inner,  SerialTestInner())   \
+    F(int64,                   big,    -5)                  \
+    F(vector<bool>,            bits,   vector<bool>())      \
+    F(lstring,                 name,   lstring())           \
+    F(SerialTestCounts,        counts, SerialTestCounts())  \
+    F(bool,                    flag,   false)               \
+
+DECLARE_SERIAL_STRUCT(SerialTest, SERIAL_TEST_FIELDS);
+DEFINE_SERIAL_STRUCT(SerialTest, SERIAL_TEST_FIELDS);
+
+// same fields as SerialTestInner, one different default
+#define SERIAL_TEST_INNER2_FIELDS(F)                        \
+    F(int,             a,     4)                            \
+    F(string,          s,     "hi")                         \
+    F(SerialTestShape, shape, SerialTestShape::SQUARE)      \
+
+DECLARE_SERIAL_STRUCT(SerialTestInner2, SERIAL_TEST_INNER2_FIELDS);
+DEFINE_SERIAL_STRUCT(SerialTestInner2, SERIAL_TEST_INNER2_FIELDS);
+
+bool serialRunTests()
+{
+    if (!IS_DEBUG)
+        return true;
+
+    // binary round trip
+    {
+        SerialTest obj;
+        const string empty = serialToBinary(obj);
+        DASSERT(empty.size() == sizeof(uint64) + 1); // schema hash and end of struct
+
+        obj.ident = 300;
+        obj.offset = float2(2.5f);
+        obj.verts.resize(100, float2(1.f));
+        obj.big = -1234567890123LL;
+        SerialTestInner inner;
+        inner.a = -7;
+        inner.s = "x";
+        inner.shape = SerialTestShape::TRIANGLE;
+        obj.inners.push_back(inner);
+        obj.inners.push_back(SerialTestInner());
+        obj.inner.s = "deep";
+        obj.bits.push_back(true);
+        obj.bits.push_back(false);
+        obj.bits.push_back(true);
+        obj.name = lstring("name");
+        obj.counts["a"] = 4;
+        obj.flag = true;
+
+        const string data = serialToBinary(obj);
+        SerialTest obj1;
+        obj1.angle = 9.f;       // reset to default, since it isn't stored
+        DASSERT(serialFromBinary(obj1, data.data(), data.size()));
+        DASSERT(obj1 == obj);
+
+        // empty is not NULL
+        obj.name = lstring("");
+        const string edata = serialToBinary(obj);
+        DASSERT(serialFromBinary(obj1, edata.data(), edata.size()));
+        DASSERT(obj1.name.c_str() && obj1 == obj);
+        obj.name = lstring("name");
+
+        for (size_t i=0; i<data.size(); i++)
+        {
+            SerialTest obj2;
+            DASSERT(!serialFromBinary(obj2, data.data(), i));
+        }
+
+        SerialTestInner2 inner2;
+        const string idata = serialToBinary(inner);
+        DASSERT(!serialFromBinary(inner2, idata.data(), idata.size()));
+        DASSERT(serialSchemaHash<SerialTestInner>() != serialSchemaHash<SerialTestInner2>());
+    }
+
+    // field table
+    {
+        SerialTest obj;
+        obj.angle = 3.f;
+        DASSERT(getField<float>(obj, "angle") == 3.f);
+        getField<float>(obj, "angle") = 4.f;
+        DASSERT(obj.angle == 4.f);
+        DASSERT(&getField<SerialTestInner>(obj, "inner") == &obj.inner);
+        DASSERT(&getField<vector<SerialTestInner> >(obj, lstring("inners")) == &obj.inners);
+        DASSERT(hasField<uint>(obj, "ident") && !hasField<int>(obj, "ident") && !hasField<uint>(obj, "nope"));
+        DASSERT(SerialTest::kFieldCount == 11);
+        DASSERT(getFieldIndex<SerialTest>("flag") == 10 && getFieldIndex<SerialTest>("nope") == -1);
+    }
+
+    // diff, patch and binary patches
+    {
+        SerialTest a, b;
+        b.angle = 2.f;
+        b.inner.a = 9;
+        b.name = lstring("q");
+        const SerialFieldMask diff = a.diffFields(b);
+        DASSERT(diff.count() == 3 && diff.test(getFieldIndex<SerialTest>("angle")) &&
+                diff.test(getFieldIndex<SerialTest>("inner")));
+        SerialTest c = a;
+        c.patchFields(b, diff);
+        DASSERT(c == b);
+
+        // dirty fields, including one set back to its default
+        SerialTest src = b;
+        SerialFieldMask dirty;
+        DASSERT(setField<float>(src, "angle", 0.f, &dirty) && setField<uint>(src, "ident", 7, &dirty));
+        DASSERT(setField<uint>(src, "ident", 7, &dirty) && !setField<int>(src, "ident", 7, &dirty));
+        DASSERT(setField<lstring>(src, "name", lstring(), &dirty));
+        DASSERT(dirty.count() == 3);
+
+        const string patch = serialPatchToBinary(src, dirty);
+        SerialTest dst = b;
+        DASSERT(serialPatchFromBinary(dst, patch.data(), patch.size()));
+        DASSERT(dst == src && !dst.name.c_str());
+        for (size_t i=0; i<patch.size(); i++)
+        {
+            SerialTest dst1;
+            DASSERT(!serialPatchFromBinary(dst1, patch.data(), i));
+        }
+    }
+    return true;
+}
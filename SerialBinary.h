@@ -0,0 +1,453 @@
+
+//
+// SerialBinary.h - compact binary format for DECLARE_SERIAL_STRUCT types
+//
+
+#ifndef SERIALBINARY_H
+#define SERIALBINARY_H
+
+// Driven by the same accept() as the text formats. Each struct is written as
+//   field number (varint, counting from 1 in FIELDS_MACRO order), field value
+//   ... only for fields that differ from their default
+//   0
+// integers are zigzag varints, floats and glm vectors are raw bytes, strings and containers are
+// a varint count followed by the elements. Vectors of raw elements are copied as one block.
+// serialToBinary prefixes a hash of the field names, types and defaults, so data written for a
+// different version of the struct is rejected instead of misread (fields left at their default
+// aren't stored, so changing a default changes what the data means). Intended for caches, not
+// for interchange - raw values are in host byte order.
+// Runs of plain fields are not copied as one block, because each field is tagged separately so
+// that fields at their default can be skipped. Vectors of plain values are.
+
+enum SerialBinaryKinds { SB_NONE=0, SB_INT, SB_RAW, SB_STRING, SB_ENUM, SB_VECTOR, SB_PAIR, SB_MAP, SB_STRUCT };
+
+template <int K> struct SBKind {};
+
+template <typename T, typename = int>
+struct SerialBinaryKind : std::integral_constant<int, std::is_integral<T>::value ? SB_INT :
+                                                      (std::is_floating_point<T>::value ||
+                                                       std::is_enum<T>::value) ? SB_RAW : SB_NONE> {};
+
+template <typename T> struct SerialBinaryKind<T, typename T::VisitEnabled> : std::integral_constant<int, SB_STRUCT> {};
+template <> struct SerialBinaryKind<std::string> : std::integral_constant<int, SB_STRING> {};
+template <> struct SerialBinaryKind<lstring> : std::integral_constant<int, SB_STRING> {};
+template <> struct SerialBinaryKind<float2> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<float3> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<float4> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<double2> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<double3> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<double4> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<int2> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<int3> : std::integral_constant<int, SB_RAW> {};
+template <> struct SerialBinaryKind<int4> : std::integral_constant<int, SB_RAW> {};
+template <typename T, typename U> struct SerialBinaryKind<SerialEnum<T, U> > : std::integral_constant<int, SB_ENUM> {};
+template <typename T, typename A> struct SerialBinaryKind<std::vector<T, A> > : std::integral_constant<int, SB_VECTOR> {};
+template <typename T, typename U> struct SerialBinaryKind<std::pair<T, U> > : std::integral_constant<int, SB_PAIR> {};
+template <typename K, typename V, typename C, typename A>
+struct SerialBinaryKind<std::map<K, V, C, A> > : std::integral_constant<int, SB_MAP> {};
+template <typename K, typename V, typename H, typename E, typename A>
+struct SerialBinaryKind<std::unordered_map<K, V, H, E, A> > : std::integral_constant<int, SB_MAP> {};
+
+template <typename T>
+using SBKindOf = SBKind<SerialBinaryKind<T>::value>;
+
+inline uint64 serialHashMix(uint64 hash, uint64 val)
+{
+    return (hash ^ val) * 1099511628211ULL;
+}
+
+template <typename T> uint64 serialSchemaHash();
+template <typename T> uint64 serialDefaultHash(const T& def);
+
+// hash of field names, value layouts and default values, see serialSchemaHash
+struct SerialSchemaVisitor {
+    uint64 hash = 14695981039346656037ULL;
+
+    template <typename T> static uint64 typeHash() { return typeHash1((T*) NULL, SBKindOf<T>()); }
+
+    template <typename T> static uint64 typeHash1(T*, SBKind<SB_INT>) { return serialHashMix(SB_INT, 2 * sizeof(T) + std::is_signed<T>::value); }
+    template <typename T> static uint64 typeHash1(T*, SBKind<SB_RAW>) { return serialHashMix(SB_RAW, sizeof(T)); }
+    template <typename T> static uint64 typeHash1(T*, SBKind<SB_STRING>) { return SB_STRING; }
+    template <typename T> static uint64 typeHash1(T*, SBKind<SB_STRUCT>) { return serialHashMix(SB_STRUCT, serialSchemaHash<T>()); }
+    template <typename T, typename U>
+    static uint64 typeHash1(SerialEnum<T, U>*, SBKind<SB_ENUM>) { return serialHashMix(SB_ENUM, typeHash<U>()); }
+    template <typename T, typename A>
+    static uint64 typeHash1(std::vector<T, A>*, SBKind<SB_VECTOR>) { return serialHashMix(SB_VECTOR, typeHash<T>()); }
+    template <typename T, typename U>
+    static uint64 typeHash1(std::pair<T, U>*, SBKind<SB_PAIR>) { return serialHashMix(serialHashMix(SB_PAIR, typeHash<T>()), typeHash<U>()); }
+    template <typename M>
+    static uint64 typeHash1(M*, SBKind<SB_MAP>)
+    {
+        return serialHashMix(serialHashMix(SB_MAP, typeHash<typename M::key_type>()), typeHash<typename M::mapped_type>());
+    }
+
+    template <typename T>
+    bool visit(const char* name, const T& val, const T& def=T())
+    {
+        static_assert(SerialBinaryKind<T>::value != SB_NONE, "field type not supported by SerialBinary");
+        hash = serialHashMix(serialHashMix(hash, lstring_hash(name, strlen(name))), typeHash<T>());
+        hash = serialHashMix(hash, serialDefaultHash(def));
+        return true;
+    }
+
+    template <typename U>
+    bool visitSkip(const char *name) { return true; }
+};
+
+// changes whenever a field of T (or of a struct inside T) is added, removed, renamed or changes
+// type or default
+template <typename T>
+uint64 serialSchemaHash()
+{
+    static const uint64 hash = []() {
+        SerialSchemaVisitor vis;
+        const_cast<T&>(T::getDefault()).accept(vis);
+        return vis.hash;
+    }();
+    return hash;
+}
+
+struct SerialBinaryWriter {
+    std::string           &out;
+    uint                   field = 0;       // number of the last field visited in the current struct
+    const SerialFieldMask *mask  = NULL;    // write exactly these fields of the outer struct, for patches
+
+    explicit SerialBinaryWriter(std::string &o) : out(o) {}
+
+    void putVarint(uint64 val)
+    {
+        while (val >= 0x80) {
+            out.push_back((char) (val | 0x80));
+            val >>= 7;
+        }
+        out.push_back((char) val);
+    }
+
+    void putRaw(const void* data, size_t size) { out.append((const char*) data, size); }
+
+    template <typename T> void put(const T& val) { put1(val, SBKindOf<T>()); }
+
+    template <typename T>
+    void put1(const T& val, SBKind<SB_INT>)
+    {
+        // zigzag so small negative numbers stay small
+        putVarint(std::is_signed<T>::value ? (((uint64) val << 1) ^ (uint64) ((int64) val >> 63)) : (uint64) val);
+    }
+
+    template <typename T> void put1(const T& val, SBKind<SB_RAW>) { putRaw(&val, sizeof(T)); }
+    template <typename T> void put1(const T& val, SBKind<SB_ENUM>) { put(val.value); }
+
+    template <typename T>
+    void put1(const T& val, SBKind<SB_STRING>)
+    {
+        putVarint(val.size());
+        putRaw(val.c_str(), val.size());
+    }
+
+    // lstring() and lstring("") are different values - store size + 1, and 0 for NULL
+    void put1(const lstring& val, SBKind<SB_STRING>)
+    {
+        putVarint(val.c_str() ? val.size() + 1 : 0);
+        putRaw(val.c_str(), val.size());
+    }
+
+    template <typename T>
+    void put1(const T& val, SBKind<SB_STRUCT>)
+    {
+        const uint parent = field;
+        const SerialFieldMask *pmask = mask;
+        field = 0;
+        mask  = NULL;
+        const_cast<T&>(val).accept(*this);
+        putVarint(0);
+        field = parent;
+        mask  = pmask;
+    }
+
+    template <typename T, typename A>
+    void put1(const std::vector<T, A>& val, SBKind<SB_VECTOR>)
+    {
+        putVarint(val.size());
+        putElements(val, std::integral_constant<bool, SerialBinaryKind<T>::value == SB_RAW>());
+    }
+
+    template <typename V>
+    void putElements(const V& val, std::true_type)
+    {
+        if (val.size())
+            putRaw(&val[0], val.size() * sizeof(val[0]));
+    }
+
+    template <typename V>
+    void putElements(const V& val, std::false_type)
+    {
+        for (size_t i=0; i<val.size(); i++)
+            put(val[i]);        // const vector<bool>::operator[] returns a plain bool
+    }
+
+    template <typename T, typename U>
+    void put1(const std::pair<T, U>& val, SBKind<SB_PAIR>)
+    {
+        put(val.first);
+        put(val.second);
+    }
+
+    template <typename M>
+    void put1(const M& val, SBKind<SB_MAP>)
+    {
+        putVarint(val.size());
+        foreach (const typename M::value_type &it, val)
+        {
+            put(it.first);
+            put(it.second);
+        }
+    }
+
+    template <typename T>
+    bool visit(const char* name, const T& val, const T& def=T())
+    {
+        static_assert(SerialBinaryKind<T>::value != SB_NONE, "field type not supported by SerialBinary");
+        field++;
+        if (mask ? !mask->test(field - 1) : (val == def))
+            return true;
+        putVarint(field);
+        put(val);
+        return true;
+    }
+
+    template <typename U>
+    bool visitSkip(const char *name) { return true; }
+};
+
+// hash of the binary form of DEF
+template <typename T>
+uint64 serialDefaultHash(const T& def)
+{
+    std::string data;
+    SerialBinaryWriter vis(data);
+    vis.put(def);
+    return lstring_hash(data.c_str(), data.size());
+}
+
+struct SerialBinaryReader {
+    const char *ptr;
+    const char *end;
+    uint        field = 0;      // number of the last field visited in the current struct
+    uint64      next  = 0;      // number of the next field stored in the data, 0 at the end of the struct
+    bool        patch = false;  // leave fields of the outer struct that aren't stored alone
+
+    SerialBinaryReader(const char* data, size_t size) : ptr(data), end(data + size) {}
+
+    size_t remaining() const { return end - ptr; }
+
+    bool getVarint(uint64 &val)
+    {
+        val = 0;
+        for (int shift=0; shift<64; shift += 7)
+        {
+            if (ptr == end)
+                return false;
+            const uint8 byte = *ptr++;
+            val |= (uint64) (byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool getRaw(void* data, size_t size)
+    {
+        if (remaining() < size)
+            return false;
+        memcpy(data, ptr, size);
+        ptr += size;
+        return true;
+    }
+
+    template <typename T> bool get(T& val) { return get1(val, SBKindOf<T>()); }
+
+    template <typename T>
+    bool get1(T& val, SBKind<SB_INT>)
+    {
+        uint64 bits = 0;
+        if (!getVarint(bits))
+            return false;
+        val = std::is_signed<T>::value ? (T) (int64) ((bits >> 1) ^ (~(bits & 1) + 1)) : (T) bits;
+        return true;
+    }
+
+    template <typename T> bool get1(T& val, SBKind<SB_RAW>) { return getRaw(&val, sizeof(T)); }
+    template <typename T> bool get1(T& val, SBKind<SB_ENUM>) { return get(val.value); }
+
+    template <typename T>
+    bool get1(T& val, SBKind<SB_STRING>)
+    {
+        uint64 size = 0;
+        if (!getVarint(size) || size > remaining())
+            return false;
+        val = T(std::string(ptr, size));
+        ptr += size;
+        return true;
+    }
+
+    bool get1(lstring& val, SBKind<SB_STRING>)
+    {
+        uint64 size = 0;
+        if (!getVarint(size) || size > remaining() + 1)
+            return false;
+        if (!size) {
+            val = lstring();
+            return true;
+        }
+        val = lstring(ptr, size - 1, lstring_hash(ptr, size - 1));
+        ptr += size - 1;
+        return true;
+    }
+
+    template <typename T>
+    bool get1(T& val, SBKind<SB_STRUCT>)
+    {
+        const uint   pfield = field;
+        const uint64 pnext  = next;
+        const bool   ppatch = patch;
+        field = 0;
+        patch = false;
+        const bool success = getVarint(next) && val.accept(*this) && next == 0;
+        field = pfield;
+        next  = pnext;
+        patch = ppatch;
+        return success;
+    }
+
+    template <typename T, typename A>
+    bool get1(std::vector<T, A>& val, SBKind<SB_VECTOR>)
+    {
+        uint64 size = 0;
+        // every element takes at least one byte, so don't trust larger counts
+        if (!getVarint(size) || size > remaining())
+            return false;
+        val.clear();
+        return getElements(val, size, std::integral_constant<bool, SerialBinaryKind<T>::value == SB_RAW>());
+    }
+
+    template <typename V>
+    bool getElements(V& val, uint64 size, std::true_type)
+    {
+        if (size * sizeof(typename V::value_type) > remaining())
+            return false;
+        val.resize(size);
+        return !size || getRaw(&val[0], size * sizeof(val[0]));
+    }
+
+    template <typename V>
+    bool getElements(V& val, uint64 size, std::false_type)
+    {
+        val.reserve(size);
+        for (uint64 i=0; i<size; i++)
+        {
+            typename V::value_type elt = typename V::value_type();
+            if (!get(elt))
+                return false;
+            val.push_back(std::move(elt));
+        }
+        return true;
+    }
+
+    template <typename T, typename U>
+    bool get1(std::pair<T, U>& val, SBKind<SB_PAIR>)
+    {
+        return get(val.first) && get(val.second);
+    }
+
+    template <typename M>
+    bool get1(M& val, SBKind<SB_MAP>)
+    {
+        uint64 size = 0;
+        if (!getVarint(size) || size > remaining())
+            return false;
+        val.clear();
+        for (uint64 i=0; i<size; i++)
+        {
+            typename M::key_type key = typename M::key_type();
+            typename M::mapped_type value = typename M::mapped_type();
+            if (!get(key) || !get(value))
+                return false;
+            val[std::move(key)] = std::move(value);
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool visit(const char* name, T& val, const T& def=T())
+    {
+        field++;
+        if (field != next) {
+            if (!patch)
+                val = def;
+            return true;
+        }
+        return get(val) && getVarint(next);
+    }
+
+    template <typename U>
+    bool visitSkip(const char *name) { return true; }
+};
+
+// serialize OBJ, a DECLARE_SERIAL_STRUCT type. Fields equal to their default take no space
+template <typename T>
+std::string serialToBinary(const T& obj)
+{
+    std::string out;
+    SerialBinaryWriter vis(out);
+    const uint64 schema = serialSchemaHash<T>();
+    vis.putRaw(&schema, sizeof(schema));
+    vis.put(obj);
+    return out;
+}
+
+// false if DATA is truncated, corrupt, or was written for a different version of T
+template <typename T>
+bool serialFromBinary(T& obj, const char* data, size_t size)
+{
+    SerialBinaryReader vis(data, size);
+    uint64 schema = 0;
+    return vis.getRaw(&schema, sizeof(schema)) &&
+        schema == serialSchemaHash<T>() &&
+        vis.get(obj) &&
+        vis.remaining() == 0;
+}
+
+// only the FIELDS of OBJ (see diffFields, setField), stored even if they have default values
+// apply with serialPatchFromBinary
+template <typename T>
+std::string serialPatchToBinary(const T& obj, const SerialFieldMask& fields)
+{
+    std::string out;
+    SerialBinaryWriter vis(out);
+    const uint64 schema = serialSchemaHash<T>();
+    vis.putRaw(&schema, sizeof(schema));
+    vis.mask = &fields;
+    const_cast<T&>(obj).accept(vis);
+    vis.putVarint(0);
+    return out;
+}
+
+// overwrite the fields stored by serialPatchToBinary, leaving the rest of OBJ alone
+// OBJ may be partly patched if this fails
+template <typename T>
+bool serialPatchFromBinary(T& obj, const char* data, size_t size)
+{
+    SerialBinaryReader vis(data, size);
+    vis.patch = true;
+    uint64 schema = 0;
+    return vis.getRaw(&schema, sizeof(schema)) &&
+        schema == serialSchemaHash<T>() &&
+        vis.getVarint(vis.next) &&
+        obj.accept(vis) &&
+        vis.next == 0 &&
+        vis.remaining() == 0;
+}
+
+bool serialRunTests();
+
+#endif
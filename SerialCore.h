@@ -47,6 +47,59 @@
 
 typedef std::pair<lstring, uint64> SaveEnum;
 
+// number of bits needed to hold V, 0 for 0
+inline int serialBitCount(uint64 v)
+{
+    int bits = 0;
+    for (; v; v >>= 1)
+        bits++;
+    return bits;
+}
+
+// hash tables over the fields of a DEFINE_ENUM, for converting names and values
+struct SerialEnumTable {
+    const SaveEnum                 *fields;
+    vector<uint16>                  slots;      // by name hash, index + 1 into fields
+    std::unordered_map<uint64, int> values;     // first field with each value
+
+    explicit SerialEnumTable(const SaveEnum *fds) : fields(fds)
+    {
+        int count = 0;
+        while (fields[count].first)
+            count++;
+        uint size = 4;
+        while (size < 2 * count)
+            size *= 2;
+        slots.resize(size, 0);
+        for (int i=0; i<count; i++)
+        {
+            uint idx = fields[i].first.hash() & (size - 1);
+            while (slots[idx])
+                idx = (idx + 1) & (size - 1);
+            slots[idx] = i + 1;
+            values.insert(std::make_pair(fields[i].second, i));
+        }
+    }
+
+    const SaveEnum *findName(const char* name, size_t len, size_t hash) const
+    {
+        const uint mask = slots.size() - 1;
+        for (uint idx = hash & mask; slots[idx]; idx = (idx + 1) & mask)
+        {
+            const SaveEnum &se = fields[slots[idx] - 1];
+            if (se.first.hash() == hash && se.first.size() == len && memcmp(se.first.c_str(), name, len) == 0)
+                return &se;
+        }
+        return NULL;
+    }
+
+    const SaveEnum *findValue(uint64 value) const
+    {
+        std::unordered_map<uint64, int>::const_iterator it = values.find(value);
+        return (it != values.end()) ? &fields[it->second] : NULL;
+    }
+};
+
 template <typename T, typename U=uint64>
 struct SerialEnum : public T {
 
@@ -80,31 +133,41 @@ struct SerialEnum : public T {
     bool has(U bits) const { return hasBits<U>(value, bits); }
     friend bool hasBits(const SerialEnum &en, U bits) { return hasBits<U>(en.value, bits); }
     
-    static uint getBitUnion()
+    static uint getBitUnion() { return T::kBitUnion; }
+    static uint getBitCount() { return serialBitCount(T::kBitUnion); }
+
+    static const SerialEnumTable &getTable()
     {
-        static typename T::Type uni = 0;
-        if (uni == 0) {
-            for (const SaveEnum *se=T::getFields(); se->first; se++)
-                uni |= se->second;
-        }
-        return uni;
+        static const SerialEnumTable table(T::getFields());
+        return table;
     }
 
-    static uint getBitCount()
+    // field named NAME, or NULL
+    static const SaveEnum *findName(const char* name)
+    {
+        const size_t len = strlen(name);
+        return getTable().findName(name, len, lstring_hash(name, len));
+    }
+    static const SaveEnum *findName(lstring name)
     {
-        return 1 + findLeadingOne(getBitUnion());
+        return getTable().findName(name.c_str(), name.size(), name.hash());
     }
+
+    // field with exactly VALUE, or NULL (e.g. for combinations of flags)
+    static const SaveEnum *findValue(U value) { return getTable().findValue(value); }
 };
 
 #undef DEFINE_ENUM_OP
 
 #define SERIAL_TO_SAVEENUM(K, V) SaveEnum(#K, (V)),
 #define SERIAL_TO_ENUM(X, V) X=(V),
+#define SERIAL_OR_ENUM(X, V) | (V)
 
 #define DEFINE_ENUM(TYPE, NAME, FIELDS)                                 \
     struct NAME ## _ {                                                  \
         typedef TYPE Type;                                              \
         enum Fields : TYPE { ZERO=0, FIELDS(SERIAL_TO_ENUM) };            \
+        static const TYPE kBitUnion = 0 FIELDS(SERIAL_OR_ENUM);         \
         static const SaveEnum *getFields()                              \
         {                                                               \
             static const SaveEnum val[] = { FIELDS(SERIAL_TO_SAVEENUM) { NULL, 0}  }; \
@@ -144,6 +207,9 @@ struct SerialEnum : public T {
 #define SERIAL_COPY_FIELD(TYPE, NAME, ...) NAME = sb.NAME;
 #define SERIAL_MOVE_FIELD(TYPE, NAME, ...) NAME = std::move(sb.NAME);
 #define SERIAL_ELSE_FIELD_NEQUAL(_TYPE, NAME, ...) else if ((this->NAME) != (sb.NAME)) return 0;
+#define SERIAL_DIFF_FIELD(_TYPE, NAME, ...) if ((this->NAME) != (sb.NAME)) mask.set(idx); idx++;
+#define SERIAL_PATCH_FIELD(_TYPE, NAME, ...) if (fields.test(idx++)) NAME = sb.NAME;
+#define SERIAL_COUNT_FIELD(...) + 1
 
 #define SERIAL_VISIT_FIELD_AND(TYPE, NAME, DEFAULT) vis.VISIT_DEF(NAME, TYPE(DEFAULT)) &&
 #define SERIAL_SKIP_FIELD_AND(TYPE, NAME, DEFAULT) vis.VISIT_SKIP(TYPE, #NAME) &&
@@ -152,6 +218,8 @@ struct SerialEnum : public T {
 #define SERIAL_VISIT_FIELD_AND2(TYPE, NAME) vis.visit(#NAME, (NAME)) &&
 
 #define SERIAL_PLACEHOLDER(_F)
+#define SERIAL_TO_FIELD_TABLE(TYPE, NAME, DEFAULT)                      \
+    { #NAME, lstring_hash(#NAME), serialTypeTag<TYPE>(), (size_t) ((const char*) &def.NAME - (const char*) &def) },
 
 template <typename T>
 struct GetFieldVisitor {
@@ -179,38 +247,157 @@ struct GetFieldVisitor {
     bool visitSkip(const char *name) { return true; }
 };
 
+// one bit per field, in FIELDS_MACRO order. See diffFields and patchFields
+static const int kSerialMaxFields = 128;
+typedef std::bitset<kSerialMaxFields> SerialFieldMask;
+
+// unique per type, without RTTI
+template <typename T>
+const void* serialTypeTag()
+{
+    static const char tag = 0;
+    return &tag;
+}
+
+// name -> offset and type of each field of a serial struct, built once per struct
+// open addressed by name hash, so lookups don't depend on the number of fields
+struct SerialFieldTable {
+    struct Field {
+        const char* name;
+        size_t      hash;
+        const void* type;
+        size_t      offset;
+    };
+
+    vector<Field>  fields;
+    vector<uint16> slots;       // index + 1 into fields, 0 for empty
+
+    SerialFieldTable(std::initializer_list<Field> init) : fields(init)
+    {
+        uint size = 4;
+        while (size < 2 * fields.size())
+            size *= 2;
+        slots.resize(size, 0);
+        for (int i=0; i<fields.size(); i++)
+        {
+            uint idx = fields[i].hash & (size - 1);
+            while (slots[idx])
+                idx = (idx + 1) & (size - 1);
+            slots[idx] = i + 1;
+        }
+    }
+
+    const Field *find(const char* name, size_t hash) const
+    {
+        const uint mask = slots.size() - 1;
+        for (uint idx = hash & mask; slots[idx]; idx = (idx + 1) & mask)
+        {
+            const Field &fd = fields[slots[idx] - 1];
+            if (fd.hash == hash && strcmp(fd.name, name) == 0)
+                return &fd;
+        }
+        return NULL;
+    }
+
+    // position in FIELDS_MACRO, or -1
+    int indexOf(const char* name, size_t hash) const
+    {
+        const Field *fd = find(name, hash);
+        return fd ? (fd - &fields[0]) : -1;
+    }
+
+    // pointer to field NAME of type U in OBJ, or NULL
+    template <typename U>
+    U* get(const void* obj, const char* name, size_t hash) const
+    {
+        const Field *fd = find(name, hash);
+        if (!fd || fd->type != serialTypeTag<U>())
+            return NULL;
+        return (U*) ((char*) obj + fd->offset);
+    }
+};
+
+// structs declared with DECLARE_SERIAL_STRUCT look fields up in their table
+template <typename U, typename T>
+U* findField(const T& obj, const char* field, size_t hash, typename T::FieldTableEnabled*)
+{
+    return T::getFieldTable().template get<U>(&obj, field, hash);
+}
+
+// anything else with an accept method walks the fields
+template <typename U, typename T>
+U* findField(const T& obj, const char* field, size_t hash, ...)
+{
+    GetFieldVisitor<U> vs(field);
+    const_cast<T&>(obj).accept(vs);
+    return vs.value;
+}
+
 // get a reference to a field in OBJ named FIELD (the same as getattr in Python).
 // will crash if field does not exist or type is slightly wrong
 template <typename U, typename T>
 U& getField(T& obj, const char* field)
 {
-    GetFieldVisitor<U> vs(field);
-    obj.accept(vs);
-    return *vs.value;
+    return *findField<U>(obj, field, lstring_hash(field, strlen(field)), NULL);
 }
 
 template <typename U, typename T>
 const U& getField(const T& obj, const char* field)
 {
-    GetFieldVisitor<U> vs(field);
-    const_cast<T&>(obj).accept(vs);
-    return *vs.value;
+    return *findField<U>(obj, field, lstring_hash(field, strlen(field)), NULL);
+}
+
+// interned names already know their hash
+template <typename U, typename T>
+U& getField(T& obj, lstring field)
+{
+    return *findField<U>(obj, field.c_str(), field.hash(), NULL);
+}
+
+template <typename U, typename T>
+const U& getField(const T& obj, lstring field)
+{
+    return *findField<U>(obj, field.c_str(), field.hash(), NULL);
 }
 
 // Return true if OBJ has a fields name FIELD of type U (just like hasattr in Python).
 template <typename U, typename T>
 bool hasField(const T& obj, const char* field)
 {
-    GetFieldVisitor<U> vs(field);
-    const_cast<T&>(obj).accept(vs);
-    return vs.value;
+    return findField<U>(obj, field, lstring_hash(field, strlen(field)), NULL);
 }
 
+// index of FIELD for SerialFieldMask, or -1
+template <typename T>
+int getFieldIndex(const char* field)
+{
+    return T::getFieldTable().indexOf(field, lstring_hash(field, strlen(field)));
+}
+
+// set FIELD of OBJ to VAL and mark it in DIRTY if that changed anything. false if there is no such field
+template <typename U, typename T>
+bool setField(T& obj, const char* field, const U& val, SerialFieldMask *dirty=NULL)
+{
+    const size_t hash = lstring_hash(field, strlen(field));
+    U* ptr = T::getFieldTable().template get<U>(&obj, field, hash);
+    if (!ptr)
+        return false;
+    if (*ptr == val)
+        return true;
+    *ptr = val;
+    if (dirty)
+        dirty->set(T::getFieldTable().indexOf(field, hash));
+    return true;
+}
+
+// diffFields returns the fields that differ from SB, patchFields copies only the given fields from SB
 #define DECLARE_SERIAL_STRUCT_OPS(STRUCT_NAME)                          \
     STRUCT_NAME(const STRUCT_NAME& o) { *this = o; }                    \
     STRUCT_NAME(STRUCT_NAME&& o) NOEXCEPT { *this = std::move(o); }     \
     static const STRUCT_NAME &getDefault();                             \
     bool operator==(const STRUCT_NAME& sb) const;                       \
+    SerialFieldMask diffFields(const STRUCT_NAME& sb) const;            \
+    void patchFields(const STRUCT_NAME& sb, const SerialFieldMask& fields); \
     STRUCT_NAME& operator=(const STRUCT_NAME& sb);                      \
     STRUCT_NAME& operator=(STRUCT_NAME&& sb) NOEXCEPT
     
@@ -227,6 +414,14 @@ bool hasField(const T& obj, const char* field)
             true;                                                       \
     }                                                                   \
     typedef int VisitEnabled;                                           \
+    typedef int FieldTableEnabled;                                      \
+    enum { kFieldCount = 0 FIELDS_MACRO(SERIAL_COUNT_FIELD) };          \
+    static const SerialFieldTable &getFieldTable()                      \
+    {                                                                   \
+        const STRUCT_NAME &def = getDefault();                          \
+        static const SerialFieldTable table = { FIELDS_MACRO(SERIAL_TO_FIELD_TABLE) }; \
+        return table;                                                   \
+    }                                                                   \
     DECLARE_SERIAL_STRUCT_OPS(STRUCT_NAME)
     
 
@@ -241,6 +436,19 @@ bool hasField(const T& obj, const char* field)
     {                                                           \
         if (0); FIELDS_MACRO(SERIAL_ELSE_FIELD_NEQUAL) else return 1;   \
     }                                                           \
+    SerialFieldMask STRUCT_NAME::diffFields(const STRUCT_NAME& sb) const \
+    {                                                           \
+        static_assert(0 FIELDS_MACRO(SERIAL_COUNT_FIELD) <= kSerialMaxFields, "too many fields for SerialFieldMask"); \
+        SerialFieldMask mask;                                   \
+        int idx = 0;                                            \
+        FIELDS_MACRO(SERIAL_DIFF_FIELD);                        \
+        return mask;                                            \
+    }                                                           \
+    void STRUCT_NAME::patchFields(const STRUCT_NAME& sb, const SerialFieldMask& fields) \
+    {                                                           \
+        int idx = 0;                                            \
+        FIELDS_MACRO(SERIAL_PATCH_FIELD);                       \
+    }                                                           \
     STRUCT_NAME& STRUCT_NAME::operator=(const STRUCT_NAME& sb)    \
     {                                                           \
         FIELDS_MACRO(SERIAL_COPY_FIELD);                        \
@@ -28,6 +28,19 @@
 #include "StdAfx.h"
 #include "Str.h"
 #include <cstdint>
+#include <atomic>
+#include <mutex>
+
+#if !_WIN32
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STR_SSE2 1
+#else
+#define STR_SSE2 0
+#endif
 
 namespace std {
     template class basic_string<char>;
@@ -82,6 +95,11 @@ Uint32 utf8_getch(const char **src, size_t *srclen)
     if (*srclen == 0) {
         return UNKNOWN_UNICODE;
     }
+    if (p[0] < 0x80) {
+        ++*src;
+        --*srclen;
+        return p[0];
+    }
     if (p[0] >= 0xFC) {
         if ((p[0] & 0xFE) == 0xFC) {
             if (p[0] == 0xFC && (p[1] & 0xFC) == 0x80) {
@@ -160,7 +178,39 @@ Uint32 utf8_getch(const char **src, size_t *srclen)
     return ch;
 }
 
-int utf8_advance(const string& str, int start, int len)
+#if STR_SSE2
+
+// number of the 16 bytes at PTR which start a character (i.e. are not continuation bytes)
+// sums the bytes with psadbw, since popcnt is not part of SSE2
+static inline int utf8_startcount16(const char* ptr)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+    // continuation bytes are 0x80-0xBF, or -128 to -65 as signed chars
+    const __m128i starts = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65)), _mm_set1_epi8(1));
+    const __m128i sums = _mm_sad_epu8(starts, _mm_setzero_si128());
+    return _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+}
+
+// true if the 16 bytes at PTR are all ascii
+static inline bool utf8_isascii16(const char* ptr)
+{
+    return !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ptr));
+}
+
+// true if the 16 bytes at PTR are all ascii and contain no '^' color escapes
+static inline bool utf8_isplain16(const char* ptr)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+    return !(_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('^'))));
+}
+
+#endif
+
+// the utf8 routines below are templates so that str_runtests can check the SSE paths against
+// the plain scalar loops (SIMD=false)
+
+template <bool SIMD>
+static int utf8_advance_(const string& str, int start, int len)
 {
     while (utf8_iscont(str[start]) && start > 0)
         start--;
@@ -168,8 +218,19 @@ int utf8_advance(const string& str, int start, int len)
         return start;
     else if (len < 0)
         return str.size();
+    const int size = str.size();
     int end = start;
-    for (; end<str.size(); end++)
+#if STR_SSE2
+    // skip whole blocks that don't contain the character we are looking for
+    for (; SIMD && end + 16 <= size; end += 16)
+    {
+        const int starts = utf8_startcount16(&str[end]);
+        if (starts > len)
+            break;
+        len -= starts;
+    }
+#endif
+    for (; end<size; end++)
     {
         if (!utf8_iscont(str[end])) {
             if (len == 0)
@@ -180,6 +241,11 @@ int utf8_advance(const string& str, int start, int len)
     return end;
 }
 
+int utf8_advance(const string& str, int start, int len)
+{
+    return utf8_advance_<true>(str, start, len);
+}
+
 // return substring of UTF8 starting at byte START of LEN characters (not bytes)
 string utf8_substr(const string &utf8, int start, int len)
 {
@@ -202,21 +268,34 @@ string utf8_erase(const string &str, int start, int len)
 
 // return length of substring in _characters_
 // POS and LEN are byte indexes
-size_t utf8_len(const string &str, size_t pos, size_t len)
+template <bool SIMD>
+static size_t utf8_len_(const string &str, size_t pos, size_t len)
 {
     while (utf8_iscont(str[pos]) && pos > 0)
         pos--;
-    const size_t lenc = min(str.size() - pos, len);
+    const size_t end = pos + min(str.size() - pos, len);
     size_t chars = 0;
-    for (int i=pos; i<lenc; i++)
+    size_t i = pos;
+#if STR_SSE2
+    for (; SIMD && i + 16 <= end; i += 16)
+        chars += utf8_startcount16(&str[i]);
+#endif
+    for (; i<end; i++)
         if (!utf8_iscont(str[i]))
             chars++;
-    ASSERT(chars <= lenc);
+    ASSERT(chars <= end - pos);
     return chars;
 }
 
+size_t utf8_len(const string &str, size_t pos, size_t len)
+{
+    return utf8_len_<true>(str, pos, len);
+}
+
 static int utf8_charwidth(const char* utf8)
 {
+    if ((unsigned char)utf8[0] < 0x80)
+        return 1;
     size_t size = 4;
     const uint chr = utf8_getch(&utf8, &size);
     return ((0x1100 <= chr && chr <= 0x11FF) || // hangul
@@ -226,26 +305,297 @@ static int utf8_charwidth(const char* utf8)
             ? 2 : 1;
 }
 
+// width of bytes [POS, END) of STR, looking back no further than FIRST for color escapes
+template <bool SIMD>
+static size_t utf8_width_span_(const char* str, size_t first, size_t pos, size_t end)
+{
+    size_t chars = 0;
+    size_t i = pos;
+    while (i < end)
+    {
+        size_t stop = end;
+#if STR_SSE2
+        // plain ascii runs are one column per byte
+        if (SIMD && i + 16 <= end)
+        {
+            if ((i == first || str[i-1] != '^') && utf8_isplain16(&str[i])) {
+                chars += 16;
+                i += 16;
+                continue;
+            }
+            stop = i + 16;
+        }
+#endif
+        for (; i < stop; i++)
+        {
+            if (utf8_iscont(str[i]))
+                continue;
+            // quake3 style color escapes
+            if ((i+1 < end && str[i] == '^' && isdigit(str[i+1])) ||
+                (i > first && str[i-1] == '^' && isdigit(str[i])))
+                continue;
+            chars += utf8_charwidth(&str[i]);
+        }
+    }
+    return chars;
+}
+
 // return length of substring in _character width_
 // (中文/한국어/日本語 characters are double width)
 // POS and LEN are byte indexes
-size_t utf8_width(const string &str, size_t pos, size_t len)
+template <bool SIMD>
+static size_t utf8_width_(const string &str, size_t pos, size_t len)
 {
     while (utf8_iscont(str[pos]) && pos > 0)
         pos--;
     const size_t end = pos + min(str.size() - pos, len);
-    size_t chars = 0;
-    for (int i = pos; i < end; i++)
+    return utf8_width_span_<SIMD>(str.c_str(), 0, pos, end);
+}
+
+size_t utf8_width(const string &str, size_t pos, size_t len)
+{
+    return utf8_width_<true>(str, pos, len);
+}
+
+template <bool SIMD>
+static bool utf8_valid_(const char* str, size_t len)
+{
+    static const Uint32 kMinChar[] = { 0, 0x80, 0x800, 0x10000 };
+    const Uint8 *p = (const Uint8*) str;
+    size_t i = 0;
+    while (i < len)
     {
-        if (utf8_iscont(str[i]))
+#if STR_SSE2
+        if (SIMD && i + 16 <= len && utf8_isascii16(str + i)) {
+            i += 16;
             continue;
-        // quake3 style color escapes
-        if ((i+1 < end && str[i] == '^' && isdigit(str[i+1])) ||
-            (i > 0 && str[i-1] == '^' && isdigit(str[i])))
+        }
+#endif
+        const Uint32 c = p[i];
+        if (c < 0x80) {
+            i++;
             continue;
-        chars += utf8_charwidth(&str[i]);
+        }
+        int left = 0;
+        Uint32 ch = 0;
+        if ((c & 0xE0) == 0xC0)      { left = 1; ch = c & 0x1F; }
+        else if ((c & 0xF0) == 0xE0) { left = 2; ch = c & 0x0F; }
+        else if ((c & 0xF8) == 0xF0) { left = 3; ch = c & 0x07; }
+        else
+            return false;
+        if (len - i <= (size_t)left)
+            return false;
+        for (int j=1; j<=left; j++)
+        {
+            if ((p[i+j] & 0xC0) != 0x80)
+                return false;
+            ch = (ch << 6) | (p[i+j] & 0x3F);
+        }
+        if (ch < kMinChar[left] || ch > 0x10FFFF || (0xD800 <= ch && ch <= 0xDFFF))
+            return false;
+        i += left + 1;
     }
-    return chars;
+    return true;
+}
+
+bool utf8_valid(const char* str, size_t len)
+{
+    return utf8_valid_<true>(str, len);
+}
+
+// lstring storage. Each symbol is stored once behind an lstring_header holding its hash and
+// length, so probing the table compares hashes instead of whole strings. The table is split into
+// shards selected by the high bits of the hash, each with its own lock and open addressed table.
+// Slots are only ever filled in, never cleared, so readers can probe without taking the lock - on
+// a miss they fall back to a locked insert which probes again.
+// Strings are packed end to end into append-only arena blocks owned by the shard. Blocks are
+// never moved or freed, so c_str() pointers stay valid forever.
+size_t lstring_hash(const char* str, size_t len)
+{
+    // must match the inline version in Str.h
+    uint64 hash = 0xcbf29ce484222325ULL;
+    for (size_t i=0; i<len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 0x100000001b3ULL;
+    return (size_t)hash;
+}
+
+static const lstring_header *lex_header(const char* ptr)
+{
+    return ((const lstring_header*) ptr) - 1;
+}
+
+struct LexShard {
+
+    struct Table {
+        size_t                    mask;
+        std::atomic<const char*> *slots;
+    };
+
+    static const size_t kMinBlock = 1024;
+    static const size_t kMaxBlock = 32 * 1024;
+
+    std::mutex           mutex;
+    std::atomic<Table*>  table;
+    size_t               count = 0;
+    size_t               bytes = 0;
+    vector<Table*>       retired;   // old tables, still visible to concurrent readers
+    char                *arena = NULL; // current arena block
+    size_t               arenaUsed = 0;
+    size_t               arenaSize = 0;
+
+    LexShard() : table(NULL) {}
+
+    static bool matches(const char* ptr, const char* str, size_t len, size_t hash)
+    {
+        const lstring_header *hdr = lex_header(ptr);
+        return hdr->hash == hash && hdr->len == len && memcmp(ptr, str, len) == 0;
+    }
+
+    const char* find(const char* str, size_t len, size_t hash) const
+    {
+        const Table *tbl = table.load(std::memory_order_acquire);
+        if (!tbl)
+            return NULL;
+        for (size_t i = hash & tbl->mask; ; i = (i + 1) & tbl->mask)
+        {
+            const char* ptr = tbl->slots[i].load(std::memory_order_acquire);
+            if (!ptr)
+                return NULL;
+            if (matches(ptr, str, len, hash))
+                return ptr;
+        }
+    }
+
+    static void place(Table *tbl, const char* ptr)
+    {
+        size_t i = lex_header(ptr)->hash & tbl->mask;
+        while (tbl->slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & tbl->mask;
+        tbl->slots[i].store(ptr, std::memory_order_release);
+    }
+
+    // call with mutex held
+    Table *grow(Table *old)
+    {
+        const size_t size = old ? 2 * (old->mask + 1) : 64;
+        Table *tbl = new Table;
+        tbl->mask = size - 1;
+        tbl->slots = new std::atomic<const char*>[size]();
+        if (old)
+        {
+            for (size_t i=0; i<=old->mask; i++)
+            {
+                if (const char* ptr = old->slots[i].load(std::memory_order_relaxed))
+                    place(tbl, ptr);
+            }
+            retired.push_back(old);
+        }
+        table.store(tbl, std::memory_order_release);
+        return tbl;
+    }
+
+    static char *allocBlock(size_t size)
+    {
+        char *block = (char*) malloc(size);
+        if (!block)
+            throw std::bad_alloc();
+        return block;
+    }
+
+    // call with mutex held
+    char *allocate(size_t size)
+    {
+        size = (size + alignof(lstring_header) - 1) & ~(alignof(lstring_header) - 1);
+        // don't waste the rest of the current block on a huge string
+        if (size > kMaxBlock / 4)
+        {
+            bytes += size;
+            return allocBlock(size);
+        }
+        if (arenaUsed + size > arenaSize)
+        {
+            arenaSize = arenaSize ? min(2 * arenaSize, (size_t)kMaxBlock) : (size_t)kMinBlock;
+            arena = allocBlock(arenaSize);
+            arenaUsed = 0;
+            bytes += arenaSize;
+        }
+        char *ptr = arena + arenaUsed;
+        arenaUsed += size;
+        return ptr;
+    }
+
+    const char* insert(const char* str, size_t len, size_t hash)
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        if (const char* ptr = find(str, len, hash))
+            return ptr;
+
+        Table *tbl = table.load(std::memory_order_relaxed);
+        if (!tbl || 2 * (count + 1) > tbl->mask + 1)
+            tbl = grow(tbl);
+
+        lstring_header *hdr = (lstring_header*) allocate(sizeof(lstring_header) + len + 1);
+        hdr->hash = hash;
+        hdr->len = len;
+        char *ptr = (char*) (hdr + 1);
+        memcpy(ptr, str, len);
+        ptr[len] = '\0';
+
+        place(tbl, ptr);
+        count++;
+        return ptr;
+    }
+};
+
+struct Lexicon {
+    static const int kShardBits = 6;
+    LexShard shards[1<<kShardBits];
+
+    LexShard &shard(size_t hash)
+    {
+        return shards[hash >> (8 * sizeof(size_t) - kShardBits)];
+    }
+
+    static Lexicon& instance()
+    {
+        static Lexicon *l = new Lexicon;
+        return *l;
+    }
+};
+
+const char* lstring::intern(const char* str, size_t len, size_t hash)
+{
+    DASSERT(hash == lstring_hash(str, len));
+    LexShard &shard = Lexicon::instance().shard(hash);
+    if (const char* ptr = shard.find(str, len, hash))
+        return ptr;
+    return shard.insert(str, len, hash);
+}
+
+size_t lstring::lexicon_size()
+{
+    size_t size = 0;
+    for (LexShard &shard : Lexicon::instance().shards)
+    {
+        std::lock_guard<std::mutex> l(shard.mutex);
+        size += shard.count;
+    }
+    return size;
+}
+
+size_t lstring::lexicon_bytes()
+{
+    size_t sz = sizeof(Lexicon);
+    for (LexShard &shard : Lexicon::instance().shards)
+    {
+        std::lock_guard<std::mutex> l(shard.mutex);
+        sz += shard.bytes;
+        if (const LexShard::Table *tbl = shard.table.load(std::memory_order_relaxed))
+            sz += sizeof(LexShard::Table) + (tbl->mask + 1) * sizeof(tbl->slots[0]);
+        for (const LexShard::Table *tbl : shard.retired)
+            sz += sizeof(LexShard::Table) + (tbl->mask + 1) * sizeof(tbl->slots[0]);
+    }
+    return sz;
 }
 
 std::string str_format(const char *format, ...)
@@ -260,10 +610,16 @@ std::string str_format(const char *format, ...)
 
 std::string str_vformat(const char *format, va_list vl) 
 {
+    // most strings fit on the stack, so only format once
+    char buf[256];
     va_list vl2;
     va_copy(vl2, vl);
-    const int chars = vsnprintf(NULL, 0, format, vl2);
+    const int chars = vsnprintf(buf, sizeof(buf), format, vl2);
     va_end(vl2);
+    if (chars < 0)
+        return std::string();
+    if (chars < (int)sizeof(buf))
+        return std::string(buf, chars);
     std::string s(chars, ' ');
     int r = vsnprintf(&s[0], chars+1, format, vl);
     ASSERT(r == chars);
@@ -272,14 +628,87 @@ std::string str_vformat(const char *format, va_list vl)
 
 void str_append_vformat(std::string &str, const char *format, va_list vl)
 {
+    // try a bounded amount of the spare capacity first - resize fills it, so taking all of it
+    // would make repeated appends to a large buffer quadratic
+    const size_t start = str.size();
+    const size_t spare = str.capacity() - start;
+    str.resize(start + min(max(spare, (size_t)16), (size_t)256));
     va_list vl2;
     va_copy(vl2, vl);
-    const int chars = vsnprintf(NULL, 0, format, vl2);
+    const int chars = vsnprintf(&str[start], str.size() - start, format, vl2);
     va_end(vl2);
-    const int start = str.size();
+    if (chars < 0) {
+        str.resize(start);
+        return;
+    }
+    if (start + chars < str.size()) {
+        str.resize(start + chars);
+        return;
+    }
     str.resize(start + chars);
     vsnprintf(&str[start], chars+1, format, vl);
 }
+
+str_view_t str_vformat_to(std::string &buf, const char *format, va_list vl)
+{
+    buf.clear();
+    str_append_vformat(buf, format, vl);
+    return str_view_t(buf);
+}
+
+str_view_t str_format_to(std::string &buf, const char *format, ...)
+{
+    va_list vl;
+    va_start(vl, format);
+    const str_view_t view = str_vformat_to(buf, format, vl);
+    va_end(vl);
+    return view;
+}
+
+// THREAD_LOCAL can't run destructors, so the buffer is freed from a thread exit callback
+// (same scheme as the sdl autorelease pool)
+#if _WIN32
+static VOID WINAPI freeFormatBuf(PVOID buf) { delete (std::string*) buf; }
+#else
+static void freeFormatBuf(void *buf) { delete (std::string*) buf; }
+#endif
+
+static std::string &formatBuf()
+{
+    static THREAD_LOCAL std::string *buf = NULL;
+    if (buf)
+        return *buf;
+    buf = new std::string;
+
+    static std::once_flag once;
+#if _WIN32
+    static DWORD key = FLS_OUT_OF_INDEXES;
+    std::call_once(once, []() { key = FlsAlloc(freeFormatBuf); });
+    if (key != FLS_OUT_OF_INDEXES)
+        FlsSetValue(key, buf);
+#else
+    static pthread_key_t key;
+    static int status = 0;
+    std::call_once(once, []() { status = pthread_key_create(&key, freeFormatBuf); });
+    if (!status)
+        pthread_setspecific(key, buf);
+#endif
+    return *buf;
+}
+
+str_view_t str_vformat_tmp(const char *format, va_list vl)
+{
+    return str_vformat_to(formatBuf(), format, vl);
+}
+
+str_view_t str_format_tmp(const char *format, ...)
+{
+    va_list vl;
+    va_start(vl, format);
+    const str_view_t view = str_vformat_tmp(format, vl);
+    va_end(vl);
+    return view;
+}
     
 void str_append_format(std::string &str, const char *format, ...)
 {
@@ -354,46 +783,82 @@ long chr_unshift(long chr)
 }
 
 
-std::string str_word_wrap(const std::string &str, const str_wrap_options_t &ops)
+enum WrapClass { WRAP_WORD=0, WRAP_BREAK, WRAP_NEWLINE };
+
+void str_word_wrap_lines(vector<str_wrap_line_t> &lines, const char* str, size_t len,
+                         const str_wrap_options_t &ops)
 {
-    const size_t nlsize = strlen(ops.newline)-1;
+    const int nlsize = strlen(ops.newline)-1;
 
-    std::string ret;
+    // classify bytes once instead of strchr(ops.wrap, chr) per byte
+    Uint8 cls[256] = {};
+    for (const char* p=ops.wrap; *p; p++)
+        cls[(Uint8)*p] = WRAP_BREAK;
+    cls[0] = WRAP_BREAK;
+    cls[(Uint8)'\n'] = WRAP_NEWLINE;
+
+    lines.clear();
+    int line_start  = 0;
     int line_length = 0;
-    std::string word;
-    for (int i=0; i<=str.size(); i++)
+    int word_start  = 0;
+    for (int i=0; i<=len; i++)
     {
-        char chr = (i == str.size()) ? '\0' : str[i];
-        if (strchr(ops.wrap, chr) || chr == '\n' || chr == '\0')
+        const char chr = (i == len) ? '\0' : str[i];
+        if (cls[(Uint8)chr] == WRAP_WORD)
+            continue;
+
+        const int word_len = utf8_width_span_<true>(str, word_start, word_start, i);
+        if (line_length + word_len >= ops.width && line_length > nlsize)
         {
-            const int word_len = utf8_width(word);
-            if (line_length + word_len >= ops.width && line_length > nlsize)
-            {
-                while (ret.size() && strchr(ops.wrap, ret.back()))
-                    ret.pop_back();
-                ret += ops.newline;
-                line_length = nlsize;
-            }
-            ret += word;
-            if (ops.rewrap && chr == '\n' && 0 < i && i < str.size()-1 &&
-                str[i-1] != '\n' && str[i+1] != '\n')
-            {
-                chr = ' ';
-            }
-            ret += chr;
-            if (chr == '\n')
-                line_length = 0;
-            else
-                line_length += word_len + 1;
-            word = string();
+            // drop trailing separators. Newlines inside a line were turned into spaces by rewrap
+            int end = word_start;
+            while (end > line_start && cls[(Uint8)(str[end-1] == '\n' ? ' ' : str[end-1])] == WRAP_BREAK)
+                end--;
+            str_wrap_line_t line = { line_start, end, true };
+            lines.push_back(line);
+            line_start  = word_start;
+            line_length = nlsize;
+        }
+
+        if (i == len)
+        {
+            str_wrap_line_t line = { line_start, i, false };
+            lines.push_back(line);
+            break;
+        }
+
+        if (chr == '\n' && !(ops.rewrap && 0 < i && i < len-1 &&
+                             str[i-1] != '\n' && str[i+1] != '\n'))
+        {
+            str_wrap_line_t line = { line_start, i, false };
+            lines.push_back(line);
+            line_start  = i+1;
+            line_length = 0;
         }
         else
         {
-            word += chr;
+            line_length += word_len + 1;
         }
+        word_start = i+1;
+    }
+}
+
+std::string str_word_wrap(const std::string &str, const str_wrap_options_t &ops)
+{
+    vector<str_wrap_line_t> lines;
+    str_word_wrap_lines(lines, str.c_str(), str.size(), ops);
+
+    std::string ret;
+    ret.reserve(str.size() + lines.size() * strlen(ops.newline));
+    for (int i=0; i<lines.size(); i++)
+    {
+        if (i)
+            ret += lines[i-1].wrapped ? ops.newline : "\n";
+        const size_t start = ret.size();
+        ret.append(str, lines[i].start, lines[i].end - lines[i].start);
+        if (ops.rewrap)
+            std::replace(ret.begin() + start, ret.end(), '\n', ' ');
     }
-    if (ret.back() == '\0')
-        ret.pop_back();
     return ret;
 }
 
@@ -704,6 +1169,50 @@ std::string str_capitalize_first(std::string s)
 }
 
 
+// original string building word wrap, to test str_word_wrap against
+static std::string str_word_wrap_reference(const std::string &str, const str_wrap_options_t &ops)
+{
+    const size_t nlsize = strlen(ops.newline)-1;
+
+    std::string ret;
+    int line_length = 0;
+    std::string word;
+    for (int i=0; i<=str.size(); i++)
+    {
+        char chr = (i == str.size()) ? '\0' : str[i];
+        if (strchr(ops.wrap, chr) || chr == '\n' || chr == '\0')
+        {
+            const int word_len = utf8_width(word);
+            if (line_length + word_len >= ops.width && line_length > nlsize)
+            {
+                while (ret.size() && strchr(ops.wrap, ret.back()))
+                    ret.pop_back();
+                ret += ops.newline;
+                line_length = nlsize;
+            }
+            ret += word;
+            if (ops.rewrap && chr == '\n' && 0 < i && i < str.size()-1 &&
+                str[i-1] != '\n' && str[i+1] != '\n')
+            {
+                chr = ' ';
+            }
+            ret += chr;
+            if (chr == '\n')
+                line_length = 0;
+            else
+                line_length += word_len + 1;
+            word = string();
+        }
+        else
+        {
+            word += chr;
+        }
+    }
+    if (ret.back() == '\0')
+        ret.pop_back();
+    return ret;
+}
+
 #define TEST(A, B) ASSERTF(A == B, "\n%s\n!=\n%s", str_tocstr(A), str_tocstr(B))
 
 bool str_runtests()
@@ -762,6 +1271,35 @@ bool str_runtests()
     TEST(utf8_width("NS-윤지"), 7);
     TEST(utf8_width("これか"), 6);
     TEST(utf8_width("чтобы"), 5);
+    TEST(utf8_width("^3foo^^1 bar baz quux zot  ^2"), 23);
+    TEST(utf8_len("чтобы применить дополнительное оружие"), 37);
+    TEST(utf8_valid("これか", strlen("これか")), true);
+    TEST(utf8_valid("\xc0\xaf", 2), false);
+    TEST(utf8_valid("\xed\xa0\x80", 3), false);
+    TEST(utf8_valid("foo\xe3\x81", 5), false);
+
+    // check the SSE utf8 paths against the scalar versions on random garbage
+    {
+        static const char* pieces[] = {
+            "a", "foo bar baz ", "^", "^3", "7", "\n", "чтобы", "윤지", "これか",
+            "\xf0\x9f\x98\x80", "\xc0\xaf", "\xed\xa0\x80", "\x80", "\xff"
+        };
+        std::mt19937 rng(1);
+        for (int n=0; n<1000; n++)
+        {
+            string s;
+            const int count = rng() % 40;
+            for (int i=0; i<count; i++)
+                s += pieces[rng() % arraySize(pieces)];
+            const size_t pos = s.size() ? rng() % s.size() : 0;
+            const size_t len = rng() % (s.size() + 1);
+            const int chars = rng() % 50;
+            TEST(utf8_len_<true>(s, pos, len), utf8_len_<false>(s, pos, len));
+            TEST(utf8_width_<true>(s, pos, len), utf8_width_<false>(s, pos, len));
+            TEST(utf8_advance_<true>(s, pos, chars), utf8_advance_<false>(s, pos, chars));
+            TEST(utf8_valid_<true>(s.c_str(), s.size()), utf8_valid_<false>(s.c_str(), s.size()));
+        }
+    }
     TEST(str_align("foo: 5\n"
                    "bazbar: 6"),
          "foo:    5\n"
@@ -790,8 +1328,54 @@ bool str_runtests()
     ops.width = 4;
     TEST(str_word_wrap("foo\nbar", ops), "foo\nbar");
 
+    {
+        const string txt = "스텔라 - 마리오네트";
+        vector<str_wrap_line_t> lines;
+        str_word_wrap_lines(lines, txt.c_str(), txt.size(), str_wrap_options_t(16));
+        TEST(lines.size(), 2);
+        TEST(txt.substr(lines[0].start, lines[0].end - lines[0].start), "스텔라 -");
+        TEST(txt.substr(lines[1].start, lines[1].end - lines[1].start), "마리오네트");
+    }
+
+    // check the layout based wrap against the old string building version
+    {
+        static const char* pieces[] = {
+            "a", "foo", "bar baz", " ", "  ", "\n", "\n\n", "^3", "чтобы", "윤지", "これか", "-"
+        };
+        std::mt19937 rng(2);
+        for (int n=0; n<2000; n++)
+        {
+            string s;
+            const int count = rng() % 30;
+            for (int i=0; i<count; i++)
+                s += pieces[rng() % arraySize(pieces)];
+            str_wrap_options_t wops(1 + rng() % 30);
+            wops.rewrap = rng() % 2;
+            TEST(str_word_wrap(s, wops), str_word_wrap_reference(s, wops));
+        }
+    }
+
+    {
+        const string big(1000, 'x');
+        TEST(str_format("%s%d", big.c_str(), 5), big + "5");
+        string buf = "foo";
+        str_append_format(buf, "%s", big.c_str());
+        TEST(buf, "foo" + big);
+        TEST(str_format_to(buf, "%d %s", 12, "bar").str(), "12 bar");
+        TEST(buf, "12 bar");
+        TEST(str_format_tmp("%.1f", 1.5f).str(), "1.5");
+    }
+
     TEST(str_chomp("스텔라 "), "스텔라");
     TEST(str_strip(" применить\n"), "применить");
+
+    TEST(lstring("foo").c_str(), lstring(std::string("foo")).c_str());
+    TEST(lstring("").c_str(), lstring(std::string()).c_str());
+    for (int i=0; i<1000; i++)
+        TEST(lstring(str_format("lstring%d", i)).c_str(), lstring(str_format("lstring%d", i)).c_str());
+    TEST(LSTRING("foo").c_str(), lstring("foo").c_str());
+    TEST(lstring("foo").hash(), lstring_hash("foo"));
+    TEST(lstring("foo").size(), 3);
     
 #endif
     return 1;
@@ -42,6 +42,15 @@
 #endif
 #endif
 
+// Visual Studio 2013 has no constexpr
+#ifndef CONSTEXPR
+#if _MSC_VER && _MSC_VER < 1900
+#define CONSTEXPR
+#else
+#define CONSTEXPR constexpr
+#endif
+#endif
+
 namespace std {
     extern template class basic_string<char>;
     extern template class vector<string>;
@@ -82,6 +91,29 @@ size_t utf8_len(const std::string &str, size_t pos=0, size_t len=~0);
 // POS and LEN are byte indexes
 size_t utf8_width(const std::string &str, size_t pos=0, size_t len=~0);
 
+// true if LEN bytes of STR are well formed utf8 (no overlong encodings, surrogates, etc.)
+bool utf8_valid(const char* str, size_t len);
+
+
+// 64 bit FNV-1a hash of a string, can be evaluated at compile time where the compiler has constexpr
+inline CONSTEXPR uint64 lstring_hash_(const char* str, uint64 hash)
+{
+    return *str ? lstring_hash_(str + 1, (hash ^ (unsigned char)*str) * 0x100000001b3ULL) : hash;
+}
+
+inline CONSTEXPR size_t lstring_hash(const char* str)
+{
+    return (size_t) lstring_hash_(str, 0xcbf29ce484222325ULL);
+}
+
+// same hash, for LEN bytes of STR at runtime
+size_t lstring_hash(const char* str, size_t len);
+
+// stored immediately before the characters of each interned string
+struct lstring_header {
+    size_t hash;
+    size_t len;
+};
 
 // lexicon-ized string - basically a symbol
 // very fast to copy around, compare
@@ -89,42 +121,31 @@ size_t utf8_width(const std::string &str, size_t pos=0, size_t len=~0);
 struct lstring
 {
 private:
-    struct Lexicon
-    {
-        std::mutex                      mutex;
-        std::unordered_set<std::string> strings;
-
-        const char* intern(const std::string& str)
-        {
-            std::lock_guard<std::mutex> l(mutex);
-            return strings.insert(str).first->c_str();
-        }
-
-        const char* intern(std::string&& str)
-        {
-            std::lock_guard<std::mutex> l(mutex);
-            return strings.insert(std::move(str)).first->c_str();
-        }
+    const char* m_ptr = NULL;
 
-        static Lexicon& instance()
-        {
-            static Lexicon *l = new Lexicon;
-            return *l;
-        }
-    };
+    // return the canonical copy of STR, adding it to the lexicon if needed
+    // lookups of existing strings are lock free, insertions lock one shard of the table
+    static const char* intern(const char* str, size_t len, size_t hash);
 
-    const char* m_ptr = NULL;
+    const lstring_header *header() const { return ((const lstring_header*) m_ptr) - 1; }
 
 public:
     lstring() NOEXCEPT {}
-    lstring(const std::string& str) : m_ptr(Lexicon::instance().intern(str)) { }
-    lstring(std::string &&str) NOEXCEPT : m_ptr(Lexicon::instance().intern(str)) {}
-    lstring(const char* str)        : m_ptr(str ? Lexicon::instance().intern(str) : NULL) { }
+    lstring(const std::string& str) : m_ptr(intern(str.c_str(), str.size(), lstring_hash(str.c_str(), str.size()))) { }
+    lstring(std::string &&str)      : m_ptr(intern(str.c_str(), str.size(), lstring_hash(str.c_str(), str.size()))) { }
+    lstring(const char* str)        : m_ptr(str ? intern(str, strlen(str), lstring_hash(str, strlen(str))) : NULL) { }
     lstring(const lstring& o) NOEXCEPT : m_ptr(o.m_ptr) {}
 
-    std::string str()   const { return m_ptr ? std::string(m_ptr) : ""; }
+    // HASH must be lstring_hash(STR, LEN) - see LSTRING and DEFINE_LSTRING
+    lstring(const char* str, size_t len, size_t hash) : m_ptr(intern(str, len, hash)) { }
+
+    std::string str()   const { return m_ptr ? std::string(m_ptr, header()->len) : ""; }
     const char* c_str() const { return m_ptr; }
     bool empty()        const { return !m_ptr || m_ptr[0] == '\0'; }
+    size_t size()       const { return m_ptr ? header()->len : 0; }
+
+    // computed once when the string was interned
+    size_t hash()       const { return m_ptr ? header()->hash : 0; }
     
     void clear() { m_ptr = NULL; }
 
@@ -142,28 +163,28 @@ public:
     bool operator==(const lstring &o) const { return m_ptr == o.m_ptr; }
     bool operator!=(const lstring &o) const { return m_ptr != o.m_ptr; }
 
-    static size_t lexicon_size() { return Lexicon::instance().strings.size(); }
-    
-    static size_t lexicon_bytes()
-    {
-        size_t sz = sizeof(Lexicon);
-        Lexicon &lex = Lexicon::instance();
-        std::lock_guard<std::mutex> l(lex.mutex);
-        sz += lex.strings.bucket_count() * lex.strings.load_factor() * sizeof(std::string);
-        for (const std::string &str : lex.strings)
-            sz += str.size();
-        return sz;
-    }
-    
+    static size_t lexicon_size();
+    static size_t lexicon_bytes();
 };
 
+// lstring from a string literal
+// the string is hashed and interned once per call site
+#define LSTRING(S) ([]() -> lstring {                                   \
+            static const lstring _ls(S, sizeof(S) - 1, lstring_hash(S, sizeof(S) - 1)); \
+            return _ls; }())
+
+// global symbol interned during static initialization
+// static DEFINE_LSTRING(kFoo, "foo");
+#define DEFINE_LSTRING(NAME, S)                                         \
+    const lstring NAME(S, sizeof(S) - 1, lstring_hash(S, sizeof(S) - 1))
+
 namespace std {
     template <>
     struct hash< lstring > {
         std::size_t operator()(const lstring pt) const
         {
-            // hashing the pointer, not the string
-            return std::hash<const char*>()(pt.c_str());
+            // stored in the lexicon, never recomputed
+            return pt.hash();
         }
     };
 }
@@ -174,7 +195,7 @@ inline size_t str_len(const char* str)        { return str ? strlen(str) : 0; }
 inline size_t str_len(const std::string& str) { return str.size(); }
 inline size_t str_len(const std::wstring& str) { return str.size(); }
 inline size_t str_len(char chr)               { return 1; }
-inline size_t str_len(lstring str)            { return str_len(str.c_str()); }
+inline size_t str_len(lstring str)            { return str.size(); }
 
 template <typename T>
 inline size_t str_find(const std::string &s, const T& v, size_t pos=0) { return s.find(v, pos); }
@@ -331,9 +352,37 @@ inline bool str_endswith(const S1& s1, const S2& s2)
     return str_endswith(str_tocstr(s1), str_tocstr(s2));
 }
 
+// pointer and length of characters owned by someone else - not necessarily NUL terminated
+struct str_view_t {
+    const char *ptr = NULL;
+    size_t      len = 0;
+
+    str_view_t() {}
+    str_view_t(const char* p, size_t l) : ptr(p), len(l) {}
+    str_view_t(const char* p) : ptr(p), len(str_len(p)) {}
+    str_view_t(const std::string &s) : ptr(s.c_str()), len(s.size()) {}
+
+    size_t      size()  const { return len; }
+    bool        empty() const { return len == 0; }
+    std::string str()   const { return std::string(ptr, len); }
+
+    bool operator==(const str_view_t &o) const { return len == o.len && (ptr == o.ptr || memcmp(ptr, o.ptr, len) == 0); }
+    bool operator!=(const str_view_t &o) const { return !(*this == o); }
+};
+
 std::string str_vformat(const char *format, va_list vl) __printflike(1, 0);
 std::string str_format(const char *format, ...)  __printflike(1, 2);
 
+// format into BUF, reusing its capacity. Usually a single vsnprintf pass with no allocation
+// returned view points into BUF (and is NUL terminated)
+str_view_t str_vformat_to(std::string &buf, const char *format, va_list vl) __printflike(2, 0);
+str_view_t str_format_to(std::string &buf, const char *format, ...) __printflike(2, 3);
+
+// format into a per-thread scratch buffer
+// returned view is only valid until the next str_format_tmp call on the same thread
+str_view_t str_vformat_tmp(const char *format, va_list vl) __printflike(1, 0);
+str_view_t str_format_tmp(const char *format, ...) __printflike(1, 2);
+
 void str_append_vformat(std::string &str, const char *format, va_list vl) __printflike(2, 0);
 void str_append_format(std::string &str, const char *format, ...)  __printflike(2, 3);
 
@@ -447,6 +496,18 @@ struct str_wrap_options_t {
 
 std::string str_word_wrap(const std::string &str, const str_wrap_options_t &ops=str_wrap_options_t());
 
+// one line of word wrapped text: bytes [start, end) of the original string
+// with rewrap, newlines inside a line should be treated as spaces
+struct str_wrap_line_t {
+    int  start;
+    int  end;
+    bool wrapped;               // line was broken by wrapping, not by a newline in the text
+};
+
+// word wrap LEN bytes of STR without copying, replacing LINES with the line ranges
+void str_word_wrap_lines(std::vector<str_wrap_line_t> &lines, const char* str, size_t len,
+                         const str_wrap_options_t &ops=str_wrap_options_t());
+
 std::string str_capitalize(std::string s);
 std::string str_capitalize_first(std::string s);
 
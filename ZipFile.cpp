@@ -2,12 +2,20 @@
 #include "StdAfx.h"
 #include "ZipFile.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <zlib.h>
 #include "../minizip/unzip.h"
 
 #if WIN32
 
-#define GZ_OPEN(F, M) gzopen_w(s2ws(F).c_str(), (M))
+#include <io.h>
+#include <fcntl.h>
+
+#define OPEN_READ(F) _wopen(s2ws(F).c_str(), _O_RDONLY | _O_BINARY)
+#define LSEEK64 _lseeki64
+#define READ_FD _read
+#define CLOSE_FD _close
 
 #include "../minizip/iowin32.h"
 static unzFile openZip(const string &fil)
@@ -19,7 +27,13 @@ static unzFile openZip(const string &fil)
 
 #else
 
-#define GZ_OPEN(F, M) gzopen((F), (M))
+#include <fcntl.h>
+#include <unistd.h>
+
+#define OPEN_READ(F) open((F), O_RDONLY)
+#define LSEEK64 lseek
+#define READ_FD read
+#define CLOSE_FD close
 
 static unzFile openZip(const string &fil)
 {
@@ -30,16 +44,92 @@ static unzFile openZip(const string &fil)
 
 #endif
 
-typedef pair< unzFile, std::unordered_map<string, unz64_file_pos> > ZipDirectory;
-typedef std::map<std::string, ZipDirectory> ZipFileDir;
-typedef pair<std::string, ZipDirectory> ZipFileEntry;
+struct ZipEntry {
+    unz64_file_pos pos  = {};
+    uint64         size = 0;        // uncompressed
+    uint           crc  = 0;
+};
+
+// index of one archive, built once when it is first opened
+// unzFile keeps the current entry and inflate state, so each reader borrows its own handle from
+// the pool. Loads keep a reference, so clearing the cache never closes a handle in use
+struct ZipDirectory {
+    string                               path;      // absolute path of the archive
+    std::unordered_map<string, ZipEntry> entries;   // keyed by full path inside the archive
+    std::unordered_map<string, string>   basenames; // basename -> entry path, for archives with an extra top level directory
+                                                    // "" if several entries share the basename
+
+    std::mutex                           mutex;     // protects handles
+    vector<unzFile>                      handles;   // idle handles
+
+    ~ZipDirectory()
+    {
+        foreach (unzFile uf, handles)
+            unzClose(uf);
+    }
+
+    const ZipEntry *find(const string &name) const
+    {
+        std::unordered_map<string, ZipEntry>::const_iterator it = entries.find(name);
+        if (it != entries.end())
+            return &it->second;
+        std::unordered_map<string, string>::const_iterator bt = basenames.find(str_basename(name));
+        if (bt == basenames.end() || bt->second.empty())
+            return NULL;
+        it = entries.find(bt->second);
+        return (it != entries.end()) ? &it->second : NULL;
+    }
+
+    unzFile acquire()
+    {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if (handles.size()) {
+                unzFile uf = handles.back();
+                handles.pop_back();
+                return uf;
+            }
+        }
+        return openZip(path);
+    }
+
+    void release(unzFile uf)
+    {
+        if (!uf)
+            return;
+        std::lock_guard<std::mutex> l(mutex);
+        handles.push_back(uf);
+    }
+};
+
+// borrow a handle for the current scope
+struct ZipHandle {
+    ZipDirectory &zd;
+    unzFile       uf;
+
+    explicit ZipHandle(ZipDirectory &zd_) : zd(zd_), uf(zd_.acquire()) {}
+    ~ZipHandle() { zd.release(uf); }
+};
+
+typedef std::unordered_map<std::string, shared_ptr<ZipDirectory> > ZipFileDir;
+typedef pair<const std::string, shared_ptr<ZipDirectory> > ZipFileEntry;
 
 static ZipFileDir& getZipFileDir()
 {
-    static std::map<std::string, ZipDirectory> zd;
+    static ZipFileDir zd;
     return zd;
 }
 
+static DEFINE_CVAR(int, kZipNameCacheSize, 4096);
+
+// relative path -> relative archive path. only paths inside an archive are cached, since loose
+// files and directories can appear at any time
+static std::unordered_map<std::string, std::string>& getZipNameCache()
+{
+    static std::unordered_map<std::string, std::string> names;
+    return names;
+}
+
 static std::mutex &getZipMutex()
 {
     static std::mutex m;
@@ -52,112 +142,289 @@ void ZF_ClearCached()
     ZipFileDir &zfd = getZipFileDir();
     foreach (const ZipFileEntry &ze, zfd)
     {
-        unzClose(ze.second.first);
-        DPRINT(SAVE, ("close cashed %s (%d files)", ze.first.c_str(), (int)ze.second.second.size()));
+        DPRINT(SAVE, ("close cashed %s (%d files)", ze.first.c_str(), (int)ze.second->entries.size()));
     }
     zfd.clear();
+    getZipNameCache().clear();
 }
 
 static string getZipFileName(const char* path)
 {
+    {
+        std::lock_guard<std::mutex> l(getZipMutex());
+        const std::unordered_map<std::string, std::string> &names = getZipNameCache();
+        std::unordered_map<std::string, std::string>::const_iterator it = names.find(path);
+        if (it != names.end())
+            return it->second;
+    }
+
+    string zipf;
     string dirn = path;
     do {
-        string zipf = dirn + ".zip";
-        if (OL_FileDirectoryPathExists(zipf.c_str()))
-            return zipf;
+        string zf = dirn + ".zip";
+        if (OL_FileDirectoryPathExists(zf.c_str())) {
+            zipf = zf;
+            break;
+        }
     } while ((dirn = str_dirname(dirn)).size() > 1);
-    return "";
+
+    if (zipf.empty())
+        return zipf;
+    std::lock_guard<std::mutex> l(getZipMutex());
+    std::unordered_map<std::string, std::string> &names = getZipNameCache();
+    if (names.size() >= (size_t)kZipNameCacheSize)
+        names.clear();
+    names[path] = zipf;
+    return zipf;
 }
 
-static const ZipDirectory *getZipDir(const char* path)
+// path of PATH inside ZIPF, as returned by getZipFileName
+static string getZipEntryName(const char* path, const string &zipf)
 {
-    string zipf = getZipFileName(path);
-    if (!zipf.size())
-        return NULL;
-    
-    zipf = OL_PathForFile(zipf.c_str(), "r");
+    const size_t dirlen = zipf.size() - 4; // strip .zip
+    return (strlen(path) > dirlen) ? string(path + dirlen + 1) : string();
+}
 
-    std::lock_guard<std::mutex> l(getZipMutex());
-    ZipDirectory &zd = getZipFileDir()[zipf];
-    if (zd.first)
-        return &zd;              // already cached
+static shared_ptr<ZipDirectory> getZipDir(const string &zipname)
+{
+    const string zipf = OL_PathForFile(zipname.c_str(), "r");
+
+    {
+        std::lock_guard<std::mutex> l(getZipMutex());
+        ZipFileDir::const_iterator it = getZipFileDir().find(zipf);
+        if (it != getZipFileDir().end())
+            return it->second;  // already cached
+    }
+
+    // index without holding the lock, so other archives can be loaded meanwhile
+    unzFile uf = openZip(zipf);
+    if (!uf)
+        return NULL;
 
-    zd.first = openZip(zipf);
+    shared_ptr<ZipDirectory> zd = std::make_shared<ZipDirectory>();
+    zd->path = zipf;
+    zd->handles.push_back(uf);
 
     char buf[512];
-    if (unzGoToFirstFile2(zd.first, NULL, buf, arraySize(buf), NULL, 0, NULL, 0) != UNZ_OK)
+    unz_file_info64 info;
+    if (unzGoToFirstFile2(uf, &info, buf, arraySize(buf), NULL, 0, NULL, 0) != UNZ_OK)
         return NULL;            // corrupt?
     
     do {
-        unz64_file_pos pos;
-        unzGetFilePos64(zd.first, &pos);
-        zd.second[str_basename(buf)] = pos;
-                        
-    } while (unzGoToNextFile2(zd.first, NULL, buf, arraySize(buf), NULL, 0, NULL, 0) == UNZ_OK);
-
-    return &zd;
+        ZipEntry &ze = zd->entries[buf];
+        unzGetFilePos64(uf, &ze.pos);
+        ze.size = info.uncompressed_size;
+        ze.crc  = info.crc;
+        // ambiguous basenames don't resolve to anything
+        std::pair<std::unordered_map<string, string>::iterator, bool> bt =
+            zd->basenames.insert(make_pair(str_basename(buf), string(buf)));
+        if (!bt.second)
+            bt.first->second.clear();
+    } while (unzGoToNextFile2(uf, &info, buf, arraySize(buf), NULL, 0, NULL, 0) == UNZ_OK);
+
+    DPRINT(SAVE, ("indexed %s (%d files)", zipf.c_str(), (int)zd->entries.size()));
+
+    // another thread may have indexed it first - keep theirs
+    std::lock_guard<std::mutex> l(getZipMutex());
+    shared_ptr<ZipDirectory> &zdp = getZipFileDir()[zipf];
+    if (!zdp)
+        zdp = zd;
+    return zdp;
 }
 
-static string loadCurrentFile(unzFile uf)
+static string loadEntry(unzFile uf, const ZipEntry &ze, const char* name)
 {
     string sdata;
 
-    unz_file_info64 info;
-    if (unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
-        return sdata;
-
-    if (info.uncompressed_size == 0)
+    if (ze.size == 0)
         return sdata;
 
-    if (unzOpenCurrentFile(uf) != UNZ_OK)
+    if (unzGoToFilePos64(uf, &ze.pos) != UNZ_OK || unzOpenCurrentFile(uf) != UNZ_OK)
         return sdata;
 
-    sdata.resize(info.uncompressed_size);
+    sdata.resize(ze.size);
     int read = unzReadCurrentFile(uf, (void*)sdata.data(), sdata.size());
 
-    if (read < sdata.size())
-        sdata.resize(read);
+    if (read < (int)sdata.size())
+        sdata.resize(max(read, 0));
 
-    unzCloseCurrentFile(uf);
+    if (unzCloseCurrentFile(uf) == UNZ_CRCERROR)
+        Reportf("CRC error reading '%s' (expected %08x)", name, ze.crc);
     return sdata;
 }
 
-static gzFile openGzip(const char* path, const char* mode)
+static DEFINE_CVAR(int, kGzipMaxRatio, 20);
+
+// decompressed size from the gzip ISIZE trailer, or 0 if it is useless
+// ISIZE is the size of the last member mod 2^32 and may be garbage, so treat it as a hint
+// and don't preallocate more than kGzipMaxRatio times the compressed size - callers grow as needed
+static size_t gzipSizeHint(const unsigned char* trailer, size_t compressedSize)
+{
+    const size_t isize = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((size_t)trailer[3] << 24);
+    // deflate can't do much better than 1032:1
+    if (isize > 1032 * compressedSize)
+        return 0;
+    return min(isize, (size_t)kGzipMaxRatio * compressedSize);
+}
+
+// open a file for gzread, reading its size and last four bytes through the same descriptor
+static gzFile openGzipTail(const char* abspath, size_t *size, unsigned char tail[4])
+{
+    const int fd = OPEN_READ(abspath);
+    if (fd < 0)
+        return NULL;
+    const int64 end = LSEEK64(fd, 0, SEEK_END);
+    if (end < 0 ||
+        (end >= 4 && (LSEEK64(fd, -4, SEEK_END) < 0 || READ_FD(fd, tail, 4) != 4)) ||
+        LSEEK64(fd, 0, SEEK_SET) != 0)
+    {
+        CLOSE_FD(fd);
+        return NULL;
+    }
+    *size = (size_t)end;
+    gzFile gzf = gzdopen(fd, "rb");
+    if (!gzf)
+        CLOSE_FD(fd);
+    return gzf;
+}
+
+static string gzipPath(const char* path)
+{
+    return str_endswith(path, ".gz") ? string(path) : str_concat(path, ".gz");
+}
+
+static gzFile openGzip(const char* path, size_t *sizeHint)
 {
-    const string gzp = str_endswith(path, ".gz") ? string(path) : str_concat(path, ".gz");
-    const char* abspath = OL_PathForFile(gzp.c_str(), mode);
-    gzFile gzf = GZ_OPEN(abspath, mode);
+    const string gzp = gzipPath(path);
+    const char* abspath = OL_PathForFile(gzp.c_str(), "r");
+    size_t size = 0;
+    unsigned char tail[4];
+    gzFile gzf = openGzipTail(abspath, &size, tail);
+    *sizeHint = (gzf && size >= 18) ? gzipSizeHint(tail, size) : 0;
     
     if (gzf) {
-        DPRINT(SAVE, ("%s %s", (mode[0] == 'r') ? "load" : "save", abspath));
+        DPRINT(SAVE, ("load %s", abspath));
     }
     
     return gzf;
 }
 
+struct GzStream final : public ZFStream {
+    gzFile gzf;
+    size_t hint;
+
+    GzStream(gzFile gzf_, size_t hint_) : gzf(gzf_), hint(hint_)
+    {
+        gzbuffer(gzf, 64 * 1024);
+    }
+    ~GzStream() { gzclose(gzf); }
+
+    int read(void* buf, int size) override { return gzread(gzf, buf, size); }
+    size_t sizeHint() const override { return hint; }
+    const char* error() override { return gzerror(gzf, NULL); }
+};
+
+struct ZipStream final : public ZFStream {
+    shared_ptr<ZipDirectory> zd;
+    unzFile                  uf;
+    size_t                   size;
+    int                      status = UNZ_OK;
+
+    ZipStream(shared_ptr<ZipDirectory> zd_, unzFile uf_, size_t size_)
+        : zd(std::move(zd_)), uf(uf_), size(size_) {}
+    ~ZipStream()
+    {
+        unzCloseCurrentFile(uf);
+        zd->release(uf);
+    }
+
+    int read(void* buf, int len) override
+    {
+        const int read = unzReadCurrentFile(uf, buf, len);
+        if (read >= 0)
+            return read;
+        status = read;
+        return -1;
+    }
+    size_t sizeHint() const override { return size; }
+    const char* error() override { return status == UNZ_CRCERROR ? "CRC error" : "unzip error"; }
+};
+
+// read a stream to the end, allocating once when the size hint is right
+static string readStream(ZFStream &st, const char* path)
+{
+    string buf;
+    buf.resize(st.sizeHint() ? st.sizeHint() : 4 * 1024);
+    size_t offset = 0;
+    int read = 0;
+    for (;;)
+    {
+        if (offset < buf.size()) {
+            if ((read = st.read(&buf[offset], buf.size() - offset)) <= 0)
+                break;
+            offset += read;
+            continue;
+        }
+
+        // buffer is full - check for more before growing it
+        char chunk[4 * 1024];
+        if ((read = st.read(chunk, sizeof(chunk))) <= 0)
+            break;
+        buf.resize(max(2 * buf.size(), offset + read));
+        memcpy(&buf[offset], chunk, read);
+        offset += read;
+    }
+    if (read < 0)
+        Reportf("Error reading '%s': %s", path, st.error());
+    buf.resize(offset);
+    return buf;
+}
+
+std::unique_ptr<ZFStream> ZF_OpenStream(const char* path)
+{
+    // 1. gziped file
+    size_t hint = 0;
+    gzFile gzf = openGzip(path, &hint);
+    if (gzf)
+        return std::unique_ptr<ZFStream>(new GzStream(gzf, hint));
+
+    // 2. uncompressed file - gzread passes it through
+    const char* abspath = OL_PathForFile(path, "r");
+    size_t size = 0;
+    unsigned char tail[4];
+    if ((gzf = openGzipTail(abspath, &size, tail)))
+        return std::unique_ptr<ZFStream>(new GzStream(gzf, size));
+
+    // 3. file in zip file
+    const string zipf = getZipFileName(path);
+    if (!zipf.size())
+        return NULL;
+    shared_ptr<ZipDirectory> zd = getZipDir(zipf);
+    if (!zd)
+        return NULL;
+    const ZipEntry *ze = zd->find(getZipEntryName(path, zipf));
+    if (!ze)
+        return NULL;
+    unzFile uf = zd->acquire();
+    if (!uf)
+        return NULL;
+    if (unzGoToFilePos64(uf, &ze->pos) != UNZ_OK || unzOpenCurrentFile(uf) != UNZ_OK) {
+        zd->release(uf);
+        return NULL;
+    }
+    return std::unique_ptr<ZFStream>(new ZipStream(zd, uf, ze->size));
+}
+
 string ZF_LoadFile(const char* path)
 {
     // 1. read gziped file
     {
-        gzFile gzf = openGzip(path, "r");
+        size_t hint = 0;
+        gzFile gzf = openGzip(path, &hint);
         if (gzf)
         {
-            string buf;
-            buf.resize(4 * 1024);
-            int offset = 0;
-            int read = 0;
-            while ((read = gzread(gzf, (void*)(offset + &buf[0]), buf.size() - offset)) == (buf.size() - offset))
-            {
-                offset = buf.size();
-                buf.resize(offset * 2);
-            }
-            if (read == -1) {
-                Reportf("Error reading '%s': %s", path, gzerror(gzf, NULL));
-                read = 0;
-            }
-            buf.resize(offset + read);
-            gzclose(gzf);
-            return buf;
+            GzStream st(gzf, hint);
+            return readStream(st, path);
         }
     }
 
@@ -168,84 +435,405 @@ string ZF_LoadFile(const char* path)
 
 
     // 3. read zip file
-    const ZipDirectory *zd = getZipDir(path);
+    const string zipf = getZipFileName(path);
+    if (!zipf.size())
+        return "";
+    shared_ptr<ZipDirectory> zd = getZipDir(zipf);
     if (!zd)
         return "";
-    const unz64_file_pos &pos = map_get(zd->second, str_basename(path));
-    if (!pos.pos_in_zip_directory)
+    const string name = getZipEntryName(path, zipf);
+    const ZipEntry *ze = zd->find(name);
+    if (!ze)
         return "";
-    unzGoToFilePos64(zd->first, &pos);
-    DPRINT(SAVE, ("load %s/%s", getZipFileName(path).c_str(), str_basename(path).c_str()));
-    return loadCurrentFile(zd->first);
+    DPRINT(SAVE, ("load %s/%s", zipf.c_str(), name.c_str()));
+    ZipHandle zh(*zd);
+    return zh.uf ? loadEntry(zh.uf, *ze, path) : "";
+}
+
+bool ZF_SaveFileAtomic(const char* abspath, const char* data, size_t size)
+{
+    const string tmppath = str_concat(abspath, ".b");
+#if WIN32
+    FILE *f = _wfopen(s2ws(tmppath).c_str(), L"wb");
+#else
+    FILE *f = fopen(tmppath.c_str(), "wb");
+#endif
+    if (!f) {
+        Reportf("Error opening '%s' for writing: %s", tmppath.c_str(), strerror(errno));
+        return false;
+    }
+    const size_t written = fwrite(data, 1, size, f);
+#if WIN32
+    const bool synced = (fflush(f) == 0 && _commit(_fileno(f)) == 0);
+#else
+    const bool synced = (fflush(f) == 0 && fsync(fileno(f)) == 0);
+#endif
+    if (fclose(f) != 0 || written != size || !synced) {
+        Reportf("Error writing '%s': wrote %s of %s: %s", tmppath.c_str(),
+                str_bytes_format(written).c_str(), str_bytes_format(size).c_str(), strerror(errno));
+        return false;
+    }
+
+#if WIN32
+    if (!MoveFileExW(s2ws(tmppath).c_str(), s2ws(abspath).c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Reportf("Error renaming '%s' to '%s': error %d", tmppath.c_str(), abspath, (int)GetLastError());
+        return false;
+    }
+#else
+    if (rename(tmppath.c_str(), abspath) != 0) {
+        Reportf("Error renaming '%s' to '%s': %s", tmppath.c_str(), abspath, strerror(errno));
+        return false;
+    }
+    // make the rename itself durable
+    const int dirfd = open(str_dirname(abspath).c_str(), O_RDONLY);
+    if (dirfd >= 0) {
+        if (fsync(dirfd) != 0)
+            Reportf("Error syncing directory of '%s': %s", abspath, strerror(errno));
+        close(dirfd);
+    }
+#endif
+    return true;
 }
 
 int ZF_SaveFile(const char* path, const char* data, size_t size)
 {
-    gzFile gzf = openGzip(path, "w");
-    if (!gzf) {
-        ASSERT_FAILED("openGzip", "Failed to open '%s' for %s: %s",
-                      path, str_bytes_format(size).c_str(), strerror(errno));
+    // compress in memory (in parallel for big files), then write the result as is
+    const string zdata = ZF_Compress(data, size);
+    if (zdata.empty())
         return false;
+    const string gzp = gzipPath(path);
+    const char* abspath = OL_PathForFile(gzp.c_str(), "w");
+    DPRINT(SAVE, ("save %s", abspath));
+    return ZF_SaveFileAtomic(abspath, zdata.data(), zdata.size());
+}
+
+// one background thread writes saves in order
+struct SaveQueue {
+
+    struct Job {
+        string                   path;
+        string                   data;
+        bool                     compress = false;
+        std::promise<bool>       promise;
+        std::shared_future<bool> future;
+    };
+
+    std::mutex                             mutex;
+    std::condition_variable                wake;
+    std::condition_variable                idle;
+    std::deque<Job*>                       queue;
+    std::unordered_map<std::string, Job*>  pending; // queued and not started, by path
+    bool                                   busy   = false;
+    OL_Thread                              thread = NULL;
+
+    static SaveQueue &instance()
+    {
+        static SaveQueue *q = new SaveQueue;
+        return *q;
     }
-    int written = gzwrite(gzf, data, size);
-    gzclose(gzf);
-    const bool success = (written == size);
-    if (!success) {
-        Reportf("gzwrite wrote %d of %d bytes to '%s'",
-                       written, (int)size, path);
+
+    std::shared_future<bool> push(const char* path, string &&data, bool compress)
+    {
+        const string key = compress ? gzipPath(path) : string(path);
+        std::lock_guard<std::mutex> l(mutex);
+        std::unordered_map<std::string, Job*>::iterator it = pending.find(key);
+        if (it != pending.end())
+        {
+            it->second->data = std::move(data);
+            return it->second->future;
+        }
+
+        Job *job = new Job;
+        job->path     = path;
+        job->data     = std::move(data);
+        job->compress = compress;
+        job->future   = job->promise.get_future().share();
+        queue.push_back(job);
+        pending[key] = job;
+
+        if (!thread) {
+            thread = thread_create(run, this);
+            // backstop for platforms that exit without going through the normal shutdown path
+            atexit(ZF_FlushSaves);
+        }
+        wake.notify_one();
+        return job->future;
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        idle.wait(l, [&]() { return queue.empty() && !busy; });
+    }
+
+    static void *run(void *arg)
+    {
+        thread_setup("Save");
+        SaveQueue &sq = *(SaveQueue*) arg;
+        for (;;)
+        {
+            unique_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> l(sq.mutex);
+                sq.busy = false;
+                sq.idle.notify_all();
+                sq.wake.wait(l, [&]() { return !sq.queue.empty(); });
+                job.reset(sq.queue.front());
+                sq.queue.pop_front();
+                sq.pending.erase(job->compress ? gzipPath(job->path.c_str()) : job->path);
+                sq.busy = true;
+            }
+
+            const bool success = job->compress ?
+                                 ZF_SaveFile(job->path.c_str(), job->data.data(), job->data.size()) :
+                                 OL_SaveFile(job->path.c_str(), job->data.c_str(), job->data.size());
+            if (!success)
+                Reportf("Background save to '%s' failed", job->path.c_str());
+            job->promise.set_value(success);
+            OL_ThreadEndIteration();
+        }
+        return NULL;
     }
-    return success;
+};
+
+std::shared_future<bool> ZF_SaveFileAsync(const char* path, string &&data, bool compress)
+{
+    return SaveQueue::instance().push(path, std::move(data), compress);
 }
 
-ZFDirMap ZF_LoadDirectory(const char* path, float* progress)
+void ZF_FlushSaves()
+{
+    SaveQueue::instance().flush();
+}
+
+ZFView::ZFView(string &&str)
+{
+    shared_ptr<string> buf = std::make_shared<string>(std::move(str));
+    data  = buf->c_str();
+    size  = buf->size();
+    owner = shared_ptr<const char>(buf, data);
+}
+
+ZFView::ZFView(const char* data_, size_t size_, shared_ptr<const char> owner_)
+    : owner(std::move(owner_)), data(data_), size(size_)
+{
+}
+
+// smaller files are read instead of mapped - mmap and munmap cost more than the copy
+static DEFINE_CVAR(int, kZipMapMinSize, 64 * 1024);
+
+static ZFView mapFile(const char* path)
+{
+    size_t size = 0;
+    const char* data = OL_MapFile(path, &size, kZipMapMinSize);
+    if (!data)
+        return ZFView();
+    return ZFView(data, size, shared_ptr<const char>(data, [size](const char* ptr) { OL_UnmapFile(ptr, size); }));
+}
+
+ZFView ZF_LoadFileView(const char* path)
+{
+    // gzip and zip contents are decompressed into memory anyway
+    if (!str_endswith(path, ".gz") && !OL_FileDirectoryPathExists(str_concat(path, ".gz").c_str()))
+    {
+        ZFView view = mapFile(path);
+        if (view.data)
+            return view;
+    }
+    return ZFView(ZF_LoadFile(path));
+}
+
+static DEFINE_CVAR(int, kZipThreads, 0); // 0 means one per core
+
+// helper threads for parallelFor, started on first use and kept for the life of the process
+// created with thread_create/thread_setup to get the big stack, terminate handler and rng
+struct WorkerPool {
+
+    struct Batch {
+        const std::function<void(int)> *work = NULL;
+        int helpers = 0;        // helper slots not yet claimed
+        int next    = 1;        // worker index for the next helper (0 is the caller)
+        int active  = 0;        // helpers currently running work
+    };
+
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<Batch*>      queue;
+    vector<OL_Thread>       threads;
+
+    static WorkerPool &instance()
+    {
+        static WorkerPool *p = new WorkerPool;
+        return *p;
+    }
+
+    // call work(0) on this thread and work(1..helpers) on pool threads, return when all are done
+    void run(int helpers, const std::function<void(int)> &work)
+    {
+        Batch batch;
+        batch.work    = &work;
+        batch.helpers = helpers;
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            queue.push_back(&batch);
+            while ((int) threads.size() < helpers)
+                threads.push_back(thread_create(loop, this));
+            wake.notify_all();
+        }
+
+        work(0);
+
+        // helpers that have not started yet would find nothing left to do
+        std::unique_lock<std::mutex> l(mutex);
+        if (batch.helpers)
+            queue.erase(std::find(queue.begin(), queue.end(), &batch));
+        batch.helpers = 0;
+        done.wait(l, [&]() { return batch.active == 0; });
+    }
+
+    static void *loop(void *arg)
+    {
+        thread_setup("Zip");
+        WorkerPool &pool = *(WorkerPool*) arg;
+        std::unique_lock<std::mutex> l(pool.mutex);
+        for (;;)
+        {
+            pool.wake.wait(l, [&]() { return !pool.queue.empty(); });
+            Batch *batch = pool.queue.front();
+            const int worker = batch->next++;
+            if (--batch->helpers == 0)
+                pool.queue.pop_front();
+            batch->active++;
+
+            l.unlock();
+            (*batch->work)(worker);
+            OL_ThreadEndIteration();
+            l.lock();
+
+            if (--batch->active == 0)
+                pool.done.notify_all();
+        }
+        return NULL;
+    }
+};
+
+// call fn(i, worker) for each i in [0, count) from a pool of worker threads, worker in [0, threads)
+// progress is updated by the calling thread as items finish
+template <typename F>
+static void parallelFor(int count, int threads, float* progress, const F &fn)
+{
+    std::atomic<int> next(0);
+    std::atomic<int> done(0);
+    const std::function<void(int)> work = [&](int worker) {
+        int i;
+        while ((i = next++) < count)
+        {
+            fn(i, worker);
+            const int finished = ++done;
+            if (progress && worker == 0)
+                *progress = (float) finished / count;
+        }
+    };
+
+    if (threads > 1)
+        WorkerPool::instance().run(threads - 1, work);
+    else
+        work(0);
+    if (progress && count)
+        *progress = 1.f;
+}
+
+static int workerThreads(int count)
+{
+    const int threads = kZipThreads > 0 ? kZipThreads : OL_GetCpuCount();
+    return clamp(threads, 1, max(count, 1));
+}
+
+void ZF_ParallelFor(int count, float* progress, const std::function<void(int)> &fn)
+{
+    parallelFor(count, workerThreads(count), progress, [&](int i, int) { fn(i); });
+}
+
+// call onFile(name, view) for each loose file and onEntry(name, string&&) for each zip entry
+// files are enumerated first, then read or inflated in parallel, then handed over in order
+template <typename OnFile, typename OnEntry>
+static void loadDirectory(const char* path, float* progress, const OnFile &onFile, const OnEntry &onEntry)
 {
-    ZFDirMap dir;
-    
     const char** files = OL_ListDirectory(path);
     if (files)
     {
-        int count = 0;
-        for (const char** ptr=files; *ptr; ptr++)
-            count++;
-        int i=0;
+        vector<string> fnames;
         for (const char** ptr=files; *ptr; ptr++)
+            fnames.push_back(str_path_join(path, *ptr));
+
+        vector<ZFView> views(fnames.size());
+        parallelFor(fnames.size(), workerThreads(fnames.size()), progress, [&](int i, int) {
+            views[i] = mapFile(fnames[i].c_str());
+            if (!views[i].data) {
+                // OL_LoadFile memory belongs to this worker thread, take a copy
+                const char* data = OL_LoadFile(fnames[i].c_str());
+                if (data)
+                    views[i] = ZFView(string(data));
+            }
+        });
+
+        for (int i=0; i<fnames.size(); i++)
         {
-            string fname = str_path_join(path, *ptr);
-            const char* data = OL_LoadFile(fname.c_str());
-            if (data) {
-                dir[fname] = data;
+            if (views[i].data) {
+                onFile(fnames[i], views[i]);
             } else {
-                Reportf("Error loading '%s' from '%s'", *ptr, path);
+                Reportf("Error loading '%s' from '%s'", str_basename(fnames[i]).c_str(), path);
             }
-            if (progress)
-                *progress = (float) i / count;
-            i++;
         }
-        return dir;
+        return;
     }
 
-    string zipf = getZipFileName(path);
-    if (!zipf.size())
-        return dir;
-    zipf = OL_PathForFile(zipf.c_str(), "r");
-
-    unzFile uf = openZip(zipf);
-    if (!uf)
-        return dir;
-    char buf[512];
-    if (unzGoToFirstFile2(uf, NULL, buf, arraySize(buf), NULL, 0, NULL, 0) != UNZ_OK)
-        goto done;
-    dir[buf] = loadCurrentFile(uf);
+    const string zipname = getZipFileName(path);
+    if (!zipname.size())
+        return;
+    shared_ptr<ZipDirectory> zd = getZipDir(zipname);
+    if (!zd)
+        return;
 
-    while (unzGoToNextFile2(uf, NULL, buf, arraySize(buf), NULL, 0, NULL, 0) == UNZ_OK)
+    vector<const string*>   names;
+    vector<const ZipEntry*> entries;
+    foreach (const auto &it, zd->entries)
     {
-        dir[buf] = loadCurrentFile(uf);
+        names.push_back(&it.first);
+        entries.push_back(&it.second);
     }
 
-    DPRINT(SAVE, ("load %s", zipf.c_str()));
+    const int threads = workerThreads(names.size());
+    vector<string> contents(names.size());
+    parallelFor(names.size(), threads, progress, [&](int i, int) {
+        ZipHandle zh(*zd);
+        if (zh.uf)
+            contents[i] = loadEntry(zh.uf, *entries[i], names[i]->c_str());
+    });
+
+    for (int i=0; i<names.size(); i++)
+        onEntry(names[i]->c_str(), std::move(contents[i]));
 
-done:
-    unzClose(uf);
+    DPRINT(SAVE, ("load %s (%d files, %d threads)", zd->path.c_str(), (int)names.size(), threads));
+}
+
+ZFDirMap ZF_LoadDirectory(const char* path, float* progress)
+{
+    ZFDirMap dir;
+    loadDirectory(path, progress,
+                  [&](const string &fname, const ZFView &view) { dir[fname].assign(view.data, view.size); },
+                  [&](const char* fname, string &&data) { dir[fname] = std::move(data); });
+    return dir;
+}
+
+ZFDirViewMap ZF_LoadDirectoryViews(const char* path, float* progress)
+{
+    ZFDirViewMap dir;
+    loadDirectory(path, progress,
+                  [&](const string &fname, const ZFView &view) { dir[fname] = view; },
+                  [&](const char* fname, string &&data) { dir[fname] = ZFView(std::move(data)); });
     return dir;
 }
 
@@ -275,7 +863,16 @@ static string closeInflate(z_stream &stream, string&& str)
         return closeInflate(stream, "");                                \
     }
 
-string ZF_Compress(const char* data, size_t size)
+static DEFINE_CVAR(int, kZipBlockSize, 128 * 1024);          // compress bigger inputs in parallel blocks of this size
+static DEFINE_CVAR(int, kZipFastLevelSize, 16 * 1024 * 1024); // use kZipFastLevel for inputs at least this big. 0 to disable
+static DEFINE_CVAR(int, kZipFastLevel, 1);
+
+static int compressionLevel(size_t size)
+{
+    return (kZipFastLevelSize > 0 && size >= kZipFastLevelSize) ? kZipFastLevel : Z_DEFAULT_COMPRESSION;
+}
+
+static string compressStream(const char* data, size_t size, int level)
 {
     z_stream stream;
     int stat = 0;
@@ -289,7 +886,7 @@ string ZF_Compress(const char* data, size_t size)
     stream.zfree = (free_func)0;
     stream.opaque = (voidpf)0;
     
-    CHECK_DEFLATE(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    CHECK_DEFLATE(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY), Z_OK);
     dest.resize(deflateBound(&stream, size));
     stream.next_out = (Bytef*)dest.data();
     stream.avail_out = (uInt)dest.size();
@@ -298,6 +895,90 @@ string ZF_Compress(const char* data, size_t size)
     return closeDeflate(stream, std::move(dest));
 }
 
+// raw deflate one block, primed with the preceding 32k of input so the ratio barely suffers
+// blocks other than the last end on a byte boundary (sync flush), so they can be concatenated
+static string compressBlock(const char* data, size_t size, const char* dict, size_t dictSize, bool last, int level)
+{
+    z_stream stream;
+    int stat = 0;
+    string dest;
+
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+
+    CHECK_DEFLATE(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    if (dictSize) {
+        CHECK_DEFLATE(deflateSetDictionary(&stream, (const Bytef*)dict, (uInt)dictSize), Z_OK);
+    }
+    dest.resize(deflateBound(&stream, size) + 16); // plus the sync flush marker
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)size;
+    stream.next_out = (Bytef*)dest.data();
+    stream.avail_out = (uInt)dest.size();
+    if (last) {
+        CHECK_DEFLATE(deflate(&stream, Z_FINISH), Z_STREAM_END);
+        dest.resize(stream.total_out);
+        return closeDeflate(stream, std::move(dest));
+    }
+
+    CHECK_DEFLATE(deflate(&stream, Z_SYNC_FLUSH), Z_OK);
+    ASSERT(stream.avail_in == 0);
+    dest.resize(stream.total_out);
+    deflateEnd(&stream); // Z_DATA_ERROR here just means the stream was not finished
+    return dest;
+}
+
+static void appendLE32(string &str, uint val)
+{
+    for (int i=0; i<4; i++)
+        str.push_back((char) ((val >> (8 * i)) & 0xff));
+}
+
+string ZF_Compress(const char* data, size_t size)
+{
+    const int level = compressionLevel(size);
+    const size_t blockSize = max(kZipBlockSize, 32 * 1024);
+    const int blocks = (int) ((size + blockSize - 1) / blockSize);
+    const int threads = workerThreads(blocks);
+    if (blocks < 2 || threads < 2)
+        return compressStream(data, size, level);
+
+    // pigz style: independent raw deflate blocks in one gzip member
+    vector<string> parts(blocks);
+    vector<uLong>  crcs(blocks);
+    parallelFor(blocks, threads, NULL, [&](int i, int) {
+        const size_t start = i * blockSize;
+        const size_t len = min(blockSize, size - start);
+        const size_t dictSize = min(start, (size_t) 32 * 1024);
+        parts[i] = compressBlock(data + start, len, data + start - dictSize, dictSize, i == blocks - 1, level);
+        crcs[i] = crc32(0, (const Bytef*)data + start, (uInt)len);
+    });
+
+    size_t total = 18;
+    foreach (const string &part, parts)
+    {
+        if (part.empty())
+            return "";
+        total += part.size();
+    }
+
+    static const char kHeader[10] = { '\x1f', '\x8b', Z_DEFLATED, 0, 0, 0, 0, 0, 0, '\xff' };
+    string dest;
+    dest.reserve(total);
+    dest.append(kHeader, sizeof(kHeader));
+    uLong crc = crcs[0];
+    for (int i=0; i<blocks; i++)
+    {
+        dest += parts[i];
+        if (i > 0)
+            crc = crc32_combine(crc, crcs[i], (z_off_t) min(blockSize, size - i * blockSize));
+    }
+    appendLE32(dest, (uint)crc);
+    appendLE32(dest, (uint)size);
+    return dest;
+}
+
 string ZF_Decompress(const char* data, size_t size)
 {
     if (!data || size == 0)
@@ -305,9 +986,9 @@ string ZF_Decompress(const char* data, size_t size)
     z_stream stream;
     int stat = 0;
 
-    // last dword is uncompressed size, but is only occasionally correct?
-    const uint last_dword = ((uint*) data)[(size/sizeof(uint))-1];
-    const uint uncompressed_size = clamp(last_dword, 2 * (uint)size, 20 * (uint)size);
+    // the trailer is a clamped guess, grow on Z_BUF_ERROR if it was short
+    const size_t hint = (size >= 18) ? gzipSizeHint((const unsigned char*)data + size - 4, size) : 0;
+    const size_t uncompressed_size = hint ? hint : 4 * size;
     
     string dest;
     dest.resize(uncompressed_size);
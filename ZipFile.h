@@ -2,6 +2,8 @@
 #ifndef ZIPFILE_H
 #define ZIPFILE_H
 
+#include <future>
+
 // transparently load files from gziped or zip files, in this order
 // 1. data/ships/foo.lua.gz
 // 2. data/ships/foo.lua
@@ -10,12 +12,44 @@
 // read file, gzip compressed file, or file in zip file
 string ZF_LoadFile(const char* path);
 
+// incremental reader, so large files can be parsed without holding all of them in memory
+struct ZFStream {
+    virtual ~ZFStream() {}
+
+    // read up to SIZE bytes into BUF. return number of bytes read, 0 at end of file, or -1 on error
+    virtual int read(void* buf, int size) = 0;
+
+    // expected size of the decompressed data, or 0 if unknown
+    virtual size_t sizeHint() const = 0;
+
+    // describe the last error
+    virtual const char* error() = 0;
+};
+
+// open file for streaming, searching in the same order as ZF_LoadFile. NULL if not found
+std::unique_ptr<ZFStream> ZF_OpenStream(const char* path);
+
+// call fn(i) for each i in [0, count) on the zip worker threads (see kZipThreads)
+void ZF_ParallelFor(int count, float* progress, const std::function<void(int)> &fn);
+
 // close any cached zip files
 void ZF_ClearCached();
 
-// write gzip compressed file
+// write gzip compressed file, atomically through a temp file
 int ZF_SaveFile(const char* path, const char* data, size_t size);
 
+// write DATA to ABSPATH (already resolved with OL_PathForFile) through a synced temp file, so a
+// crash leaves either the old or the new file. Binary safe, unlike OL_SaveFile on windows
+bool ZF_SaveFileAtomic(const char* abspath, const char* data, size_t size);
+
+// write DATA to PATH on a background thread, with OL_SaveFile, or ZF_SaveFile if COMPRESS
+// saves run in order, and a save replaces any save to the same path that hasn't started yet
+// (both return the same future). Future is true if the file was written
+std::shared_future<bool> ZF_SaveFileAsync(const char* path, string &&data, bool compress=false);
+
+// block until all queued saves are written
+void ZF_FlushSaves();
+
 // compress data/size into gzip format
 string ZF_Compress(const char* data, size_t size);
 
@@ -27,4 +61,27 @@ typedef std::pair<std::string, std::string> ZFFileData;
 typedef std::map<std::string, std::string> ZFDirMap;
 ZFDirMap ZF_LoadDirectory(const char* path, float* progress);
 
+// read only view of file contents. Copies share the underlying buffer or file mapping,
+// which is released along with the last copy
+struct ZFView {
+    shared_ptr<const char> owner;
+    const char*            data = NULL;
+    size_t                 size = 0;
+
+    ZFView() {}
+    explicit ZFView(string &&str);
+    ZFView(const char* data, size_t size, shared_ptr<const char> owner);
+
+    str_view_t view() const { return str_view_t(data, size); }
+    string str() const { return string(data, size); }
+    bool empty() const { return size == 0; }
+};
+
+// like ZF_LoadFile, but memory map uncompressed files instead of copying them
+ZFView ZF_LoadFileView(const char* path);
+
+// like ZF_LoadDirectory, but without copying loose files
+typedef std::map<std::string, ZFView> ZFDirViewMap;
+ZFDirViewMap ZF_LoadDirectoryViews(const char* path, float* progress);
+
 #endif
@@ -12,6 +12,9 @@
 #include <dirent.h>
 #include <dlfcn.h>
 #include <link.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include "../sdl_os/posix.h"
 #include <X11/Xlib.h>
@@ -70,36 +73,145 @@ static const string& getDataDir()
     return datadir;
 }
 
-static bool fileDirectoryPathExists(const char* fname)
+enum PathType {
+    PATH_UNKNOWN = 0,           // not looked at yet
+    PATH_WRITING,               // opened for writing, look again until it shows up (missing is not cached)
+    PATH_MISSING,
+    PATH_FILE,
+    PATH_DIR,
+};
+
+static PathType statPath(const char* fname)
 {
     struct stat buf;
     if (stat(fname, &buf)) {
-        if (errno == ENOENT)
-            return false;
-        ReportLinux("Error stating '%s': '%s'", fname, strerror(errno));
-        return false;
+        if (errno != ENOENT)
+            ReportLinux("Error stating '%s': '%s'", fname, strerror(errno));
+        return PATH_MISSING;
+    }
+    return S_ISREG(buf.st_mode) ? PATH_FILE :
+           S_ISDIR(buf.st_mode) ? PATH_DIR : PATH_MISSING;
+}
+
+// resolved save and data directory paths for a relative name, and what we found there
+// missing paths are cached too, so probing for optional files (foo.gz, then foo) only stats once.
+// Our own writes invalidate: OL_SaveFile forgets the file, os_create_parent_dirs and
+// OL_RemoveFileOrDirectory clear everything, and a path resolved for writing by anyone else
+// (e.g. ZF_SaveFile) is PATH_WRITING until it shows up
+struct PathInfo {
+    shared_ptr<string> save, data;  // shared with the autorelease pool, so returned pointers stay valid
+    PathType           saveType = PATH_UNKNOWN;
+    PathType           dataType = PATH_UNKNOWN;
+};
+
+static const size_t                         kMaxPathInfos = 4096;
+static std::mutex                           g_pathsMutex;
+static std::unordered_map<string, PathInfo> g_paths;
+
+// call with g_pathsMutex held
+static PathInfo &getPathInfo(const char* fname)
+{
+    if (g_paths.size() >= kMaxPathInfos && !g_paths.count(fname))
+        g_paths.clear();
+    PathInfo &pi = g_paths[fname];
+    if (!pi.data)
+    {
+        pi.save = std::make_shared<string>(str_path_join(getSaveDir(), fname));
+        pi.data = std::make_shared<string>(str_path_join(getDataDir(), fname));
     }
+    return pi;
+}
 
-    return S_ISREG(buf.st_mode) || S_ISDIR(buf.st_mode);
+static const char *autoreleasePath(const shared_ptr<string> &path)
+{
+    return sdl_os_autorelease(shared_ptr<const char>(path, path->c_str()));
+}
+
+// stat outside the lock so loader threads don't serialize on it
+static PathType updatePathType(const char* fname, PathType PathInfo::*field, PathType last, const char* path)
+{
+    if (last >= PATH_MISSING)
+        return last;
+    const PathType type = statPath(path);
+    if (last == PATH_UNKNOWN || type > PATH_MISSING)
+    {
+        std::lock_guard<std::mutex> l(g_pathsMutex);
+        PathType &cached = getPathInfo(fname).*field;
+        // unless someone opened it for writing since we looked
+        if (cached == last)
+            cached = type;
+    }
+    return type;
+}
+
+static const char *resolvePath(const char *fname, const char* flags, PathType *type)
+{
+    const bool write   = (flags[0] == 'w' || flags[0] == 'a');
+    const bool useSave = (flags[0] != 'p' && !OLG_UseDevSavePath());
+
+    PathInfo pi;
+    {
+        std::lock_guard<std::mutex> l(g_pathsMutex);
+        PathInfo &cpi = getPathInfo(fname);
+        if (write)
+        {
+            PathType &cached = useSave ? cpi.saveType : cpi.dataType;
+            if (cached < PATH_FILE)
+                cached = PATH_WRITING;
+        }
+        pi = cpi;
+    }
+
+    if (useSave)
+    {
+        const PathType saveType = write ? pi.saveType : updatePathType(fname, &PathInfo::saveType, pi.saveType, pi.save->c_str());
+        if (write || saveType > PATH_MISSING)
+        {
+            if (type)
+                *type = saveType;
+            return autoreleasePath(pi.save);
+        }
+    }
+
+    const PathType dataType = write ? pi.dataType : updatePathType(fname, &PathInfo::dataType, pi.dataType, pi.data->c_str());
+    if (type)
+        *type = dataType;
+    return autoreleasePath(pi.data);
+}
+
+static void clearPathCache()
+{
+    std::lock_guard<std::mutex> l(g_pathsMutex);
+    g_paths.clear();
+}
+
+// look FNAME up again next time, after we changed it on disk
+static void forgetPath(const char* fname)
+{
+    if (!fname || fname[0] == '/' || fname[0] == '~')
+        return;
+    std::lock_guard<std::mutex> l(g_pathsMutex);
+    g_paths.erase(fname);
 }
 
 int OL_FileDirectoryPathExists(const char* fname)
 {
-    const char *path = OL_PathForFile(fname, "r");
-    return fileDirectoryPathExists(path);
+    if (!fname || fname[0] == '/' || fname[0] == '~') {
+        const PathType type = statPath(OL_PathForFile(fname, "r"));
+        return type == PATH_FILE || type == PATH_DIR;
+    }
+    PathType type = PATH_UNKNOWN;
+    resolvePath(fname, "r", &type);
+    return type == PATH_FILE || type == PATH_DIR;
 }
 
 int OL_DirectoryExists(const char *fname)
 {
-    const char *path = OL_PathForFile(fname, "r");
-    struct stat buf;
-    if (stat(path, &buf)) {
-        if (errno == ENOENT)
-            return false;
-        ReportLinux("Error stating '%s': '%s'", fname, strerror(errno));
-        return false;
-    }
-    return S_ISDIR(buf.st_mode);
+    if (!fname || fname[0] == '/' || fname[0] == '~')
+        return statPath(OL_PathForFile(fname, "r")) == PATH_DIR;
+    PathType type = PATH_UNKNOWN;
+    resolvePath(fname, "r", &type);
+    return type == PATH_DIR;
 }
 
 const char *OL_PathForFile(const char *fname, const char* flags)
@@ -116,19 +228,7 @@ const char *OL_PathForFile(const char *fname, const char* flags)
         return sdl_os_autorelease(p);
     }
 
-    if (flags[0] != 'p')
-    {
-        string path = str_path_join(getSaveDir(), fname);
-        if (!OLG_UseDevSavePath() && (flags[0] == 'w' || 
-                                      flags[0] == 'a' || 
-                                      fileDirectoryPathExists(path.c_str())))
-        {
-            return sdl_os_autorelease(path);
-        }
-    }
-
-    string path1 = str_path_join(getDataDir(), fname);
-    return sdl_os_autorelease(path1);
+    return resolvePath(fname, flags, NULL);
 }
 
 static int recursive_mkdir(const char *dir)
@@ -160,9 +260,26 @@ static int recursive_mkdir(const char *dir)
     return 1;
 }
 
+// directories we already created or found, so repeated saves skip the mkdir calls
+static std::mutex            g_knownDirsMutex;
+static std::set<std::string> g_knownDirs;
+
 int os_create_parent_dirs(const char* path)
 {
-    return recursive_mkdir(str_dirname(path).c_str());
+    const string dir = str_dirname(path);
+    {
+        std::lock_guard<std::mutex> l(g_knownDirsMutex);
+        if (g_knownDirs.count(dir))
+            return 1;
+    }
+    const bool success = recursive_mkdir(dir.c_str());
+    // directories (or some of them) may exist now that were cached as missing
+    clearPathCache();
+    if (!success)
+        return 0;
+    std::lock_guard<std::mutex> l(g_knownDirsMutex);
+    g_knownDirs.insert(dir);
+    return 1;
 }
 
 bool os_symlink_f(const char* source, const char* dest)
@@ -195,6 +312,14 @@ int OL_SaveFile(const char *name, const char* data, int size)
     if (bytesWritten != size)
     {
         ReportLinux("writing to '%s', wrote %d bytes of expected %d\n", fnameb.c_str(), bytesWritten, size);
+        fclose(f);
+        return 0;
+    }
+    // make sure the data is on disk before the rename makes it visible
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+    {
+        ReportLinux("error syncing '%s': %s\n", fnameb.c_str(), strerror(errno));
+        fclose(f);
         return 0;
     }
     if (fclose(f) != 0)
@@ -208,10 +333,52 @@ int OL_SaveFile(const char *name, const char* data, int size)
         ReportLinux("error renaming temp file from '%s' to '%s': %s'\n", fnameb.c_str(), fname, strerror(errno));
         return 0;
     }
+    forgetPath(name);
+
+    // and that the rename survives a crash
+    const int dirfd = open(str_dirname(fname).c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0 || fsync(dirfd) != 0)
+        ReportLinux("error syncing directory of '%s': %s\n", fname, strerror(errno));
+    if (dirfd >= 0)
+        close(dirfd);
 
     return 1;
 }
 
+const char *OL_MapFile(const char *name, size_t *size, size_t minsize)
+{
+    const char *fname = OL_PathForFile(name, "r");
+    *size = 0;
+
+    const int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    const char *data = NULL;
+    struct stat buf;
+    if (fstat(fd, &buf)) {
+        ReportLinux("Error stating '%s': %s", fname, strerror(errno));
+    } else if (S_ISREG(buf.st_mode) && buf.st_size > 0 && (size_t)buf.st_size >= minsize) {
+        void *ptr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ReportLinux("mmap('%s', %d bytes) failed: %s", fname, (int)buf.st_size, strerror(errno));
+        } else {
+            // mapped files are almost always parsed front to back, start reading ahead now
+            madvise(ptr, buf.st_size, MADV_WILLNEED);
+            data  = (const char*) ptr;
+            *size = buf.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+void OL_UnmapFile(const char *data, size_t size)
+{
+    if (data && munmap((void*)data, size))
+        ReportLinux("munmap(%p, %d bytes) failed: %s", data, (int)size, strerror(errno));
+}
+
 int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
 {
     int rv = remove(fpath);
@@ -225,48 +392,86 @@ int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW
 
 int OL_RemoveFileOrDirectory(const char* dirname)
 {
+    {
+        std::lock_guard<std::mutex> l(g_knownDirsMutex);
+        g_knownDirs.clear();
+    }
     const char *path = OL_PathForFile(dirname, "r");
     nftw(path, unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
+    clearPathCache();
     return 1;
 }
 
-static std::set<std::string> listDirectory(const char* path1, const char *flags)
-{
-    const char* path = OL_PathForFile(path1, flags);
+struct linux_dirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+};
 
-    std::set<std::string> files;
-    
-    DIR *dir = opendir(path);
-    if (!dir) {
+// append each name in directory PATH to NAMES, '\0' terminated, and its offset to OFFSETS, sorted
+// reads entries in big batches with getdents64, straight into one buffer
+static void listDirectory(const char* path, string &names, vector<uint> &offsets)
+{
+    const int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
         // ReportLinux("Error opening directory '%s': %s", path, strerror(errno));
-        return files;
+        return;
     }
-    dirent *entry = NULL;
-    while ((entry = readdir(dir)))
+
+    const size_t start = offsets.size();
+    alignas(linux_dirent64) char buf[16 * 1024];
+    for (;;)
     {
-        if (entry->d_name[0] != '.')
-            files.insert(entry->d_name);
+        const long bytes = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (bytes <= 0) {
+            if (bytes < 0)
+                ReportLinux("Error reading directory '%s': %s", path, strerror(errno));
+            break;
+        }
+        for (long pos=0; pos<bytes; )
+        {
+            const linux_dirent64 *entry = (const linux_dirent64*) (buf + pos);
+            pos += entry->d_reclen;
+            if (entry->d_name[0] == '.')
+                continue;
+            offsets.push_back(names.size());
+            names.append(entry->d_name, strlen(entry->d_name) + 1);
+        }
     }
-    closedir(dir);
-    return files;
+    close(fd);
+
+    std::sort(offsets.begin() + start, offsets.end(), [&](uint a, uint b) {
+            return strcmp(names.c_str() + a, names.c_str() + b) < 0; });
 }
 
 const char** OL_ListDirectory(const char* path)
 {
-    // not thread safe!!
-    static vector<const char*> elements;
-
-    std::set<std::string> files = listDirectory(path, "p");
-    std::set<std::string> local = listDirectory(path, "w");
-
-    foreach (const std::string &file, local)
-        files.insert(file);
-
-    elements.clear();
-    foreach (const std::string &file, files)
-        elements.push_back(lstring(file).c_str());
-    elements.push_back(NULL);
-    return &elements[0];
+    string names;
+    vector<uint> package, local;
+    listDirectory(OL_PathForFile(path, "p"), names, package);
+    // not OL_PathForFile(path, "w"), which would mark the directory as being written
+    if (path[0] != '/' && path[0] != '~' && !OLG_UseDevSavePath())
+        listDirectory(str_path_join(getSaveDir(), path).c_str(), names, local);
+
+    // merge the two sorted listings, dropping duplicates
+    vector<const char*> files;
+    files.reserve(package.size() + local.size());
+    const char* base = names.c_str();
+    size_t i = 0, j = 0;
+    while (i < package.size() || j < local.size())
+    {
+        const char* pname = (i < package.size()) ? base + package[i] : NULL;
+        const char* lname = (j < local.size()) ? base + local[j] : NULL;
+        const int cmp = !pname ? 1 : !lname ? -1 : strcmp(pname, lname);
+        files.push_back(cmp <= 0 ? pname : lname);
+        if (cmp <= 0)
+            i++;
+        if (cmp >= 0)
+            j++;
+    }
+    return sdl_os_autorelease_list(files.size() ? &files[0] : NULL, files.size());
 }
 
 string os_get_platform_info()
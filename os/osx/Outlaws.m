@@ -223,6 +223,23 @@ const char *OL_LoadFile(const char *fname)
     return [contents UTF8String];
 }
 
+const char *OL_LoadFileView(const char *fname, size_t *size)
+{
+    const char *data = OL_LoadFile(fname);
+    *size = data ? strlen(data) : 0;
+    return data;
+}
+
+const char *OL_MapFile(const char *fname, size_t *size, size_t minsize)
+{
+    *size = 0;
+    return NULL;
+}
+
+void OL_UnmapFile(const char *data, size_t size)
+{
+}
+
 int OL_SaveFile(const char *fname, const char* data, int size)
 {
     NSString *path = pathForFileName(fname, "w");
@@ -4,8 +4,13 @@
 #include "StdAfx.h"
 
 #include <locale>
+#include <atomic>
+#if !OL_WINDOWS
+#include <pthread.h>
+#endif
 
 #include "Graphics.h"
+#include "ZipFile.h"
 
 #include "sdl_inc.h"
 #include "sdl_os.h"
@@ -17,8 +22,7 @@ static SDL_Window*  g_displayWindow  = NULL;
 static bool         g_quitting       = false;
 static SDL_RWops   *g_logfile        = NULL;
 static const char*  g_logpath        = NULL;
-static string       g_logdata;
-static bool         g_openinglog = false;
+static string       g_logdata;     // messages reported by the log thread itself, under g_logMutex
 static int          g_supportsTearControl = -1;
 static bool         g_wantsLogUpload = false;
 
@@ -83,17 +87,13 @@ static bool readUploadLog(string& data)
     return data.size() ? OLG_UploadLog(data.c_str(), data.size()) : 0;
 }
 
+static void logClose(const char* reason);
+
 void sdl_os_oncrash(const string &message)
 {
     ReportSDL("%s\n", message.c_str());
+    logClose("crash handler closing log\n");
     fflush(NULL);
-    if (g_logfile)
-    {
-        ReportSDL("crash handler closing log\n");
-        SDL_RWclose(g_logfile);
-        g_logfile = NULL;
-    }
-    g_quitting = true;          // prevent log from reopening
 
     string data;
     bool success = readUploadLog(data);
@@ -150,50 +150,221 @@ void anonymizeUsername(string &str)
     }
 }
 
-void OL_ReportMessage(const char *str_)
+// Messages are queued by the reporting thread and written by the log thread.
+// The queue is a bounded multi-producer ring (Vyukov), so reporting never takes a lock
+struct LogQueue {
+    static const size_t kSize = 4096;
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        char               *msg;
+    };
+
+    Cell                cells[kSize];
+    std::atomic<size_t> head;
+    size_t              tail = 0;   // only touched by the consumer, under g_logMutex
+
+    LogQueue() : head(0)
+    {
+        for (size_t i=0; i<kSize; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // false if full
+    bool push(char *msg)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & (kSize - 1)];
+            const size_t seq = cell.seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.msg = msg;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // NULL if empty
+    char *pop()
+    {
+        Cell &cell = cells[tail & (kSize - 1)];
+        const size_t seq = cell.seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(tail + 1) < 0)
+            return NULL;
+        char *msg = cell.msg;
+        cell.seq.store(tail + kSize, std::memory_order_release);
+        tail++;
+        return msg;
+    }
+};
+
+static LogQueue          g_logqueue;
+static std::timed_mutex  g_logMutex;    // held while draining the queue and writing
+static SDL_sem          *g_logsem;      // posted once per queued message, and to stop the log thread
+static OL_Thread         g_logthread;
+static std::atomic<bool> g_logstarted(false);
+static std::atomic<bool> g_logstop(false);
+static THREAD_LOCAL bool t_islogthread = false;
+static THREAD_LOCAL bool t_haslogmutex = false; // this thread holds g_logMutex
+
+static void logOpen()
+{
+    const char* path = OL_PathForFile(OLG_GetLogFileName(), "w");
+    os_create_parent_dirs(path);
+    g_logfile = SDL_RWFromFile(path, "w");
+    if (!g_logfile)
+        return;
+    g_logpath = lstring(path).c_str();
+    ReportSDL("Log file opened at %s", path);
+    const char* latestpath = OL_PathForFile("data/log_latest.txt", "w");
+    os_symlink_f(g_logpath, latestpath);
+}
+
+// write everything queued so far, in one batch. false if there was nothing to write
+static bool logDrain()
 {
+    static string batch;
+    batch.swap(g_logdata);
+    while (char *msg = g_logqueue.pop())
+    {
+        batch += msg;
+        free(msg);
+    }
+    if (batch.empty())
+        return false;
+
+    if (!g_logfile && !g_quitting)
+    {
+        logOpen();
+        // pick up whatever logOpen reported
+        batch += g_logdata;
+        g_logdata.clear();
+    }
+
 #if OL_WINDOWS
-    OutputDebugStringA(str_);
+    OutputDebugStringA(batch.c_str());
 #endif
-    printf("%s", str_);
+    printf("%s", batch.c_str());
+
+    if (g_logfile)
+    {
+        anonymizeUsername(batch);
+#if OL_WINDOWS
+        batch = str_replace(batch, "\n", OL_ENDL);
+#endif
+        SDL_RWwrite(g_logfile, batch.c_str(), batch.size(), 1);
+    }
+    batch.clear();
+    return true;
+}
+
+static void *logThread(void *)
+{
+    thread_setup("Log");
+    t_islogthread = true;
+    while (!g_logstop)
+    {
+        SDL_SemWait(g_logsem);
+        // one drain covers every message posted so far
+        while (SDL_SemTryWait(g_logsem) == 0);
+
+        g_logMutex.lock();
+        t_haslogmutex = true;
+        logDrain();
+        t_haslogmutex = false;
+        g_logMutex.unlock();
+        OL_ThreadEndIteration();
+    }
+    return NULL;
+}
 
-    if (g_quitting)
+static void logCloseFile(const char* reason)
+{
+    if (!g_logfile)
         return;
+    if (reason)
+        SDL_RWwrite(g_logfile, reason, strlen(reason), 1);
+    SDL_RWwrite(g_logfile, OL_ENDL, strlen(OL_ENDL), 1);
+    SDL_RWclose(g_logfile);
+    g_logfile = NULL;
+}
 
-    string str = str_;
-    anonymizeUsername(str);
-    
-    if (!g_logfile) {
-        if (g_openinglog) {
+// stop the log thread, write out everything still queued and close the file
+// doesn't wait for the log thread, so it is safe to call from the crash handler - gives up on
+// the queue if the log thread is stuck holding the lock
+static void logClose(const char* reason)
+{
+    g_logstop = true;
+    if (g_logsem)
+        SDL_SemPost(g_logsem);
+
+    if (t_haslogmutex)
+    {
+        // crashed on the log thread while draining - the batch may be half written, just close
+        g_quitting = true;
+        logCloseFile(reason);
+        return;
+    }
+
+    if (g_logMutex.try_lock_for(std::chrono::milliseconds(100)))
+    {
+        if (g_logfile && reason)
+            g_logdata += reason;
+        while (logDrain());
+        g_quitting = true;      // prevent log from reopening
+        logCloseFile(NULL);
+        g_logMutex.unlock();
+    }
+    g_quitting = true;          // even if we gave up on the lock
+}
+
+void OL_ReportMessage(const char *str)
+{
+    if (g_quitting || g_logstop) {
+        printf("%s", str);
+        return;
+    }
+
+    // messages from the log thread itself (e.g. while opening the log) go straight to the next
+    // batch. It can't wait on its own queue, but it can take the lock when it isn't draining
+    if (t_islogthread) {
+        if (t_haslogmutex) {
             g_logdata += str;
-            return;
-        }
-        g_openinglog = true;
-        const char* path = OL_PathForFile(OLG_GetLogFileName(), "w");
-        if (!g_logfile) { // may have been opened by OL_PathForFile
-            os_create_parent_dirs(path);
-            g_logfile = SDL_RWFromFile(path, "w");
-            if (!g_logfile)
-                return;
-            g_logpath = lstring(path).c_str();
-            g_openinglog = false;
-            if (g_logdata.size()) {
-#if OL_WINDOWS
-                g_logdata = str_replace(g_logdata, "\n", OL_ENDL);
-#endif
-                SDL_RWwrite(g_logfile, g_logdata.c_str(), g_logdata.size(), 1);
-            }
-            // call self recursively
-            ReportSDL("Log file opened at %s", path);
-            const char* latestpath = OL_PathForFile("data/log_latest.txt", "w");
-            os_symlink_f(g_logpath, latestpath);
+        } else {
+            std::lock_guard<std::timed_mutex> l(g_logMutex);
+            g_logdata += str;
+            SDL_SemPost(g_logsem);
         }
+        return;
+    }
+
+    static std::once_flag started;
+    std::call_once(started, []() {
+        g_logsem = SDL_CreateSemaphore(0);
+        g_logthread = thread_create(logThread, NULL);
+        g_logstarted = true;
+    });
+
+    char *msg = strdup(str);
+    while (!g_logqueue.push(msg))
+        std::this_thread::yield();
+    SDL_SemPost(g_logsem);
+
+    // logClose may have done its final drain after we checked g_logstop - don't leave this queued
+    if (g_logstop && g_logMutex.try_lock_for(std::chrono::milliseconds(100)))
+    {
+        while (logDrain());
+        g_logMutex.unlock();
     }
-#if OL_WINDOWS
-    str = str_replace(str, "\n", OL_ENDL);
-#endif
-    
-    SDL_RWwrite(g_logfile, str.c_str(), str.size(), 1);
 }
 
 int OL_GetFullscreen(void)
@@ -985,30 +1156,70 @@ void OL_ThreadBeginIteration()
 {
 }
 
+#if OL_WINDOWS
+// Win32Main.cpp
+void ReportWin32Err1(const char *msg, DWORD dwLastError, const char* file, int line);
+#endif
+
+// one pool per thread, so autoreleasing never takes a lock
+// THREAD_LOCAL can't run destructors, so the pool is freed from a thread exit callback
 struct AutoreleasePool {
-    std::mutex                                 mutex;
-    std::map<std::thread::id, vector<string> > pool;
+    deque<string>                   strings; // deque so pushing never moves earlier strings
+    vector<shared_ptr<const char> > views;
+
+#if OL_WINDOWS
+    static VOID WINAPI onThreadExit(PVOID pool) { delete (AutoreleasePool*) pool; }
+#else
+    static void onThreadExit(void *pool) { delete (AutoreleasePool*) pool; }
+#endif
 
     static AutoreleasePool &instance() 
     {
-        static AutoreleasePool p;
-        return p;
+        static THREAD_LOCAL AutoreleasePool *p = NULL;
+        if (p)
+            return *p;
+        p = new AutoreleasePool;
+
+        static std::once_flag once;
+#if OL_WINDOWS
+        static DWORD key = FLS_OUT_OF_INDEXES;
+        std::call_once(once, []() {
+            key = FlsAlloc(onThreadExit);
+            if (key == FLS_OUT_OF_INDEXES)
+                ReportWin32Err1("FlsAlloc", GetLastError(), __FILE__, __LINE__);
+        });
+        if (key != FLS_OUT_OF_INDEXES && !FlsSetValue(key, p))
+            ReportWin32Err1("FlsSetValue", GetLastError(), __FILE__, __LINE__);
+#else
+        static pthread_key_t key;
+        static int status = 0;
+        std::call_once(once, []() {
+            if ((status = pthread_key_create(&key, onThreadExit)))
+                Reportf("pthread_key_create failed: %s", strerror(status));
+        });
+        int err = 0;
+        if (!status && (err = pthread_setspecific(key, p)))
+            Reportf("pthread_setspecific failed: %s", strerror(err));
+#endif
+        return *p;
     }
 
     const char* autorelease(std::string &val)
     {
-        std::lock_guard<std::mutex> l(mutex);
-        std::thread::id tid = std::this_thread::get_id();
-        vector<string> &ref= pool[tid];
-        ref.push_back(std::move(val));
-        return ref.back().c_str();
+        strings.push_back(std::move(val));
+        return strings.back().c_str();
+    }
+
+    const char* autorelease(shared_ptr<const char> &&view)
+    {
+        views.push_back(std::move(view));
+        return views.back().get();
     }
 
     void drain()
     {
-        std::lock_guard<std::mutex> l(mutex);
-        std::thread::id tid = std::this_thread::get_id();
-        pool[tid].clear();
+        strings.clear();
+        views.clear();
     }
     
 };
@@ -1018,6 +1229,34 @@ const char* sdl_os_autorelease(std::string &val)
     return AutoreleasePool::instance().autorelease(val);
 }
 
+const char* sdl_os_autorelease(std::shared_ptr<const char> val)
+{
+    return AutoreleasePool::instance().autorelease(std::move(val));
+}
+
+const char** sdl_os_autorelease_list(const char* const* names, int count)
+{
+    // pointers first, then the characters, all in one allocation
+    const size_t header = (count + 1) * sizeof(const char*);
+    size_t bytes = header;
+    for (int i=0; i<count; i++)
+        bytes += strlen(names[i]) + 1;
+
+    char *block = (char*) malloc(bytes);
+    const char** list = (const char**) block;
+    char *ptr = block + header;
+    for (int i=0; i<count; i++)
+    {
+        const size_t len = strlen(names[i]) + 1;
+        memcpy(ptr, names[i], len);
+        list[i] = ptr;
+        ptr += len;
+    }
+    list[count] = NULL;
+    AutoreleasePool::instance().autorelease(shared_ptr<const char>(block, free));
+    return list;
+}
+
 const char *OL_LoadFile(const char *name)
 {
     const char *fname = OL_PathForFile(name, "r");
@@ -1029,6 +1268,29 @@ const char *OL_LoadFile(const char *name)
     return sdl_os_autorelease(buf);
 }
 
+// below this, mmap and munmap cost more than reading
+static const size_t kMapMinSize = 64 * 1024;
+
+const char *OL_LoadFileView(const char *name, size_t *size)
+{
+    const char *data = OL_MapFile(name, size, kMapMinSize);
+    if (data)
+    {
+        const size_t len = *size;
+        return AutoreleasePool::instance().autorelease(
+            shared_ptr<const char>(data, [len](const char *ptr) { OL_UnmapFile(ptr, len); }));
+    }
+
+    // small, not mappable, or no mmap on this platform - fall back to a copy
+    const char *fname = OL_PathForFile(name, "r");
+    SDL_RWops *io = SDL_RWFromFile(fname, "r");
+    if (!io)
+        return NULL;
+    string buf = loadFile(io, fname);
+    *size = buf.size();
+    return sdl_os_autorelease(buf);
+}
+
 void OL_ThreadEndIteration()
 {
     AutoreleasePool::instance().drain();
@@ -1245,21 +1507,17 @@ int sdl_os_main(int argc, const char **argv)
     }
 
     OLG_OnQuit();
+    ZF_FlushSaves();
 
-    if (g_logfile)
+    logClose(g_wantsLogUpload ? "\n[SDL] Log upload requested\n[SDL] Closing log for shutdown" :
+                                "\n[SDL] Closing log for shutdown");
+    if (g_logstarted)
+        thread_join(g_logthread);
+
+    if (g_logpath && g_wantsLogUpload)
     {
-        if (g_wantsLogUpload)
-            ReportSDL("Log upload requested");
-        ReportSDL("Closing log for shutdown");
-        SDL_RWwrite(g_logfile, OL_ENDL, strlen(OL_ENDL), 1);
-        SDL_RWclose(g_logfile);
-        g_logfile = NULL;
-
-        if (g_wantsLogUpload)
-        {
-            string data;
-            readUploadLog(data);
-        }
+        string data;
+        readUploadLog(data);
     }
 
     fflush(NULL);
@@ -14,6 +14,12 @@ int sdl_os_main(int argc, const char **argv);
 // store a string for one frame, then autorelease
 const char* sdl_os_autorelease(std::string &val);
 
+// keep VAL alive for one frame, then release it
+const char* sdl_os_autorelease(std::shared_ptr<const char> val);
+
+// copy COUNT names into one NULL terminated array and autorelease it, for OL_ListDirectory
+const char** sdl_os_autorelease_list(const char* const* names, int count);
+
 // call from crash handler. flush log, etc.
 void sdl_os_oncrash(const std::string &message);
 
@@ -311,6 +311,44 @@ int OL_CopyFile(const char* source, const char* dest)
     return 0;
 }
 
+const char *OL_MapFile(const char *name, size_t *size, size_t minsize)
+{
+    const std::wstring path = pathForFile(name, "r");
+    *size = 0;
+
+    HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    const char *data = NULL;
+    LARGE_INTEGER fsize = {};
+    if (!GetFileSizeEx(file, &fsize)) {
+        ReportWin32ErrF(("GetFileSizeEx('%s')", ws2s(path).c_str()), GetLastError());
+    } else if (fsize.QuadPart > 0 && (ULONGLONG)fsize.QuadPart >= minsize) {
+        // the view keeps the section alive, both handles can be closed right away
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            ReportWin32ErrF(("CreateFileMapping('%s')", ws2s(path).c_str()), GetLastError());
+        } else {
+            data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!data)
+                ReportWin32ErrF(("MapViewOfFile('%s')", ws2s(path).c_str()), GetLastError());
+            else
+                *size = (size_t) fsize.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return data;
+}
+
+void OL_UnmapFile(const char *data, size_t size)
+{
+    if (data && !UnmapViewOfFile(data))
+        ReportWin32Err("UnmapViewOfFile", GetLastError());
+}
+
 static std::set<std::wstring> listDirectory(const char *path1, const char *mode)
 {
     const std::wstring path = pathForFile(path1, mode) + L"\\*";
@@ -356,14 +394,15 @@ const char** OL_ListDirectory(const char* path1)
     if (files.empty())
         return NULL;
 
-    // not thread safe!!
-    static vector<const char*> elements;
-    elements.clear();
+    vector<string> names;
+    vector<const char*> elements;
+    names.reserve(files.size());
     foreach (const std::wstring &file, files)
-        elements.push_back(lstring(ws2s(file)).c_str());
-    elements.push_back(NULL);
-    
-    return &elements[0];
+    {
+        names.push_back(ws2s(file));
+        elements.push_back(names.back().c_str());
+    }
+    return sdl_os_autorelease_list(&elements[0], elements.size());
 }
 
 bool os_symlink_f(const char* source, const char* dest)
@@ -2,6 +2,11 @@
 #include "StdAfx.h"
 #include "stl_ext.h"
 
+#if __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 int findLeadingOne(uint v, int i)
 {
     if (v&0xffff0000) { i += 16; v >>= 16; }
@@ -224,6 +229,49 @@ void thread_join(OL_Thread thread)
 
 
 static DEFINE_CVAR(int, kMempoolMaxChain, 10);
+static DEFINE_CVAR(bool, kMempoolHugePages, true);
+static DEFINE_CVAR(bool, kMempoolReleaseChained, true);
+
+#if __linux__
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// anonymous mapping, aligned to a huge page boundary when it is big enough to use them
+static char* mempool_map(size_t bytes)
+{
+    const bool huge = kMempoolHugePages && bytes >= kHugePageSize;
+    const size_t mapped = huge ? bytes + kHugePageSize : bytes;
+    char *ptr = (char*)mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        Reportf("mmap(%#llx) failed: %s", (uint64)mapped, strerror(errno));
+        return NULL;
+    }
+    if (!huge)
+        return ptr;
+
+    // trim the unaligned head and the leftover tail. the kernel rounds the mapping up to whole
+    // pages, so the tail starts at the first page boundary after our bytes
+    char *aligned = (char*)(((uintptr_t)ptr + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+    const uintptr_t pagesz = sysconf(_SC_PAGESIZE);
+    const size_t head = aligned - ptr;
+    char *tailp = (char*)(((uintptr_t)aligned + bytes + pagesz - 1) & ~(pagesz - 1));
+    char *end = (char*)(((uintptr_t)ptr + mapped + pagesz - 1) & ~(pagesz - 1));
+    if (head && munmap(ptr, head))
+        Reportf("munmap(%p, %#llx) failed: %s", ptr, (uint64)head, strerror(errno));
+    if (end > tailp && munmap(tailp, end - tailp))
+        Reportf("munmap(%p, %#llx) failed: %s", tailp, (uint64)(end - tailp), strerror(errno));
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, bytes, MADV_HUGEPAGE))
+        Reportf("madvise(MADV_HUGEPAGE) failed: %s", strerror(errno));
+#endif
+    return aligned;
+}
+
+static void mempool_unmap(char *ptr, size_t bytes)
+{
+    if (ptr && munmap(ptr, bytes))
+        Reportf("munmap(%p, %#llx) failed: %s", ptr, (uint64)bytes, strerror(errno));
+}
+#endif
 
 size_t MemoryPool::create(size_t cnt)
 {
@@ -235,6 +283,8 @@ size_t MemoryPool::create(size_t cnt)
         pool = (char*)VirtualAlloc(NULL, count * element_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
         if (!pool)
             ReportWin32Err1("VirtualAlloc", GetLastError(), __FILE__, __LINE__);
+#elif __linux__
+        pool = mempool_map(count * element_size);
 #else
         pool = (char*)malloc(count * element_size);
         if (!pool)
@@ -252,12 +302,10 @@ size_t MemoryPool::create(size_t cnt)
     if (!count)
         return 0;
 
-    first = (Chunk*) pool;
-
-    for (int i=0; i<count-1; i++) {
-        ((Chunk*) &pool[i * element_size])->next = (Chunk*) &pool[(i+1) * element_size];
-    }
-    ((Chunk*) &pool[(count-1) * element_size])->next = NULL;
+    // don't build the free list up front - elements are handed out in order the first time, so
+    // pages are first touched (and placed on a NUMA node) by the thread that actually uses them
+    first = NULL;
+    fresh = 0;
     
     return count;
 }
@@ -267,29 +315,50 @@ MemoryPool::~MemoryPool()
 #if _WIN32
     if (!VirtualFree(pool, 0, MEM_RELEASE))
         ReportWin32Err1("VirtualFree", GetLastError(), __FILE__, __LINE__);
+#elif __linux__
+    mempool_unmap(pool, count * element_size);
 #else
     free(pool);
 #endif
     delete next;
 }
 
-bool MemoryPool::isInPool(const void *pt) const
+void MemoryPool::release()
+{
+    ASSERT(used == 0);
+#if __linux__
+    const size_t pagesz = sysconf(_SC_PAGESIZE);
+    const size_t bytes = fresh * element_size;
+    const size_t len = min(count * element_size, bytes + pagesz - 1 - (bytes + pagesz - 1) % pagesz);
+    if (len && madvise(pool, len, MADV_DONTNEED)) {
+        Reportf("madvise(MADV_DONTNEED) failed: %s", strerror(errno));
+        return;
+    }
+    // pages read back as zero, so the free list is gone too
+    first = NULL;
+    fresh = 0;
+#endif
+}
+
+bool MemoryPool::isInThisPool(const void *pt) const
 {
-    if (!pool)
-        return false;
     const char *ptr = (char*) pt;
-    const size_t idx = (ptr - pool) / element_size;
-    if (idx >= count)
-        return next ? next->isInPool(pt) : false;
-    ASSERT(pool + (idx  * element_size) == ptr);
+    if (!pool || ptr < pool || ptr >= pool + count * element_size)
+        return false;
+    ASSERT((ptr - pool) % element_size == 0);
     return true;
 }
 
+bool MemoryPool::isInPool(const void *pt) const
+{
+    return isInThisPool(pt) || (next && next->isInPool(pt));
+}
+
 void* MemoryPool::allocate()
 {
     std::lock_guard<std::mutex> l(mutex);
 
-    if (!first) {
+    if (!first && fresh == count) {
         ASSERT(pool);
         if (!next) {
             if (index+1 >= kMempoolMaxChain) {
@@ -308,6 +377,13 @@ void* MemoryPool::allocate()
         return next->allocate();
     }
 
+    if (!first) {
+        char *ptr = &pool[fresh * element_size];
+        fresh++;
+        used++;
+        return (void*) ptr;
+    }
+
     Chunk *chunk = first;
     first = first->next;
     used++;
@@ -318,7 +394,7 @@ void MemoryPool::deallocate(void *ptr)
 {
     std::lock_guard<std::mutex> l(mutex);
 
-    if (!isInPool(ptr))
+    if (!isInThisPool(ptr))
     {
         ASSERT(next);
         if (next)
@@ -330,4 +406,20 @@ void MemoryPool::deallocate(void *ptr)
     chunk->next = first;
     first = chunk;
     used--;
+
+    // keep this pool hot, but give back the pages of the empty overflow pool after it. An alloc/free
+    // loop at a pool boundary then never pays for madvise and the page faults after it
+    if (used == 0 && next && kMempoolReleaseChained)
+        next->releaseIfUnused();
+}
+
+// and any empty pools chained after it
+void MemoryPool::releaseIfUnused()
+{
+    std::lock_guard<std::mutex> l(mutex);
+    if (used != 0)
+        return;
+    release();
+    if (next)
+        next->releaseIfUnused();
 }
@@ -31,6 +31,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <bitset>
+#include <unordered_map>
 #include <algorithm>
 #include <type_traits>
 
@@ -1404,11 +1406,19 @@ class MemoryPool {
     const size_t  element_size;
     size_t        count = 0;
     size_t        used  = 0;
+    size_t        fresh = 0;    // elements below this index have been handed out at least once
     char         *pool  = NULL;
     Chunk        *first = NULL;
     MemoryPool   *next  = NULL; // next pool
     int           index = 0;    // index in pool chain
 
+    // return pages of a completely free pool to the OS
+    void release();
+    void releaseIfUnused();
+
+    // PT is in this pool, not counting chained pools
+    bool isInThisPool(const void *pt) const;
+
 public:
 
     MemoryPool(size_t sz) : element_size(sz) {}